@@ -51,17 +51,41 @@
 #include "zigbee_helpers.h"
 
 #include "app_timer.h"
+#include "app_scheduler.h"
 #include "bsp.h"
 #include "boards.h"
 
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
-#include "nrf_log_default_backends.h"
+#include "nrf_log_backend_rtt.h"
+#include "nrf_log_backend_uart.h"
 #include "zigbee_logger_eprxzcl.h"
 #include "zboss_api_addons.h"
 
+#include "switch_personality.h"
+#include "switch_battery.h"
+#include "switch_nvram.h"
+#include "switch_ota_delta.h"
+#include "switch_gp.h"
 #include "zb_ha_hue_dimmer_switch.h"
 #include "nrf_drv_saadc.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_radio.h"
+#include "nrf_assert.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_nvmc.h"
+#include "sha256.h"
+
+/* Build profiles - which of the two endpoints is compiled in. Select one with e.g.
+ * CFLAGS += -DSWITCH_BUILD_PROFILE=SWITCH_BUILD_PROFILE_ZHA (or PROFILE=zha with the Makefile). */
+#define SWITCH_BUILD_PROFILE_FULL           0                                   /**< ZLL endpoint 1 and ZHA endpoint 2. */
+#define SWITCH_BUILD_PROFILE_ZHA            1                                   /**< ZHA endpoint only - button events go to the Hue bridge. */
+#define SWITCH_BUILD_PROFILE_ZLL            2                                   /**< ZLL endpoint only - the switch controls bound lights directly. */
+#ifndef SWITCH_BUILD_PROFILE
+#define SWITCH_BUILD_PROFILE                SWITCH_BUILD_PROFILE_FULL
+#endif
+#define SWITCH_ZLL_EP_ENABLED               (SWITCH_BUILD_PROFILE != SWITCH_BUILD_PROFILE_ZHA)
+#define SWITCH_ZHA_EP_ENABLED               (SWITCH_BUILD_PROFILE != SWITCH_BUILD_PROFILE_ZLL)
 
 #define IEEE_CHANNEL_MASK                   (1l << ZIGBEE_CHANNEL)              /**< Scan only one, predefined channel to find the coordinator. */
 #define LIGHT_SWITCH_ZLL_ENDPOINT               0x1                                   /**< ZLL Source endpoint used to control light bulb. */
@@ -84,6 +108,47 @@
 #define LIGHT_SWITCH_BUTTON_SHORT_POLL_TMO  ZB_MILLISECONDS_TO_BEACON_INTERVAL(50)  /**< Delay between button state checks used in order to detect button long press. */
 #define LIGHT_SWITCH_BUTTON_LONG_POLL_TMO   ZB_MILLISECONDS_TO_BEACON_INTERVAL(300) /**< Time after which the button state is checked again to detect button hold - the dimm command is sent again. */
 
+/* Press-path and polling timings. Guarded so that alternative settings can be compared by
+ * passing them on the compiler command line (e.g. CFLAGS += -DSWITCH_KEEPALIVE_TIMEOUT=...). */
+#ifndef LIGHT_SWITCH_BUTTON_HOLD_INTERVAL
+#define LIGHT_SWITCH_BUTTON_HOLD_INTERVAL   ZB_MILLISECONDS_TO_BEACON_INTERVAL(800)  /**< Interval between button-hold events sent to the bridge while a button is held. */
+#endif
+#define LIGHT_SWITCH_MAX_PENDING_FRAMES     2                                        /**< Upper bound of button event frames waiting for confirmation (press or hold, plus release). */
+#ifndef LIGHT_SWITCH_BUTTON_MAX_HOLD_MS
+#define LIGHT_SWITCH_BUTTON_MAX_HOLD_MS     25000                                    /**< Hold time after which a gesture is finished even if no release was seen. The final frame may come up to one hold interval later; its 100 ms counter saturates at 25.5 s. */
+#endif
+#define SWITCH_SCHED_MAX_EVENT_SIZE         sizeof(zb_uint8_t)                       /**< Largest event handed from interrupt context to the main loop through the app scheduler (a button event). */
+#define SWITCH_SCHED_QUEUE_SIZE             8                                        /**< Events the app scheduler holds until the main loop runs them. */
+#ifndef LIGHT_SWITCH_BUTTON_HOLD_INTERVAL_LOW_POWER
+#define LIGHT_SWITCH_BUTTON_HOLD_INTERVAL_LOW_POWER ZB_MILLISECONDS_TO_BEACON_INTERVAL(1600) /**< Button-hold repeat interval in the reduced-power profile. */
+#endif
+#ifndef SWITCH_LOW_POWER_POLL_INTERVAL_MS
+#define SWITCH_LOW_POWER_POLL_INTERVAL_MS   30000                                    /**< Long poll interval in the reduced-power profile (ms). */
+#endif
+#ifndef SWITCH_LOW_POWER_LOG_LEVEL
+#define SWITCH_LOW_POWER_LOG_LEVEL          NRF_LOG_SEVERITY_WARNING                 /**< Most verbose log messages still produced in the reduced-power profile. */
+#endif
+#ifndef SWITCH_KEEPALIVE_TIMEOUT
+#define SWITCH_KEEPALIVE_TIMEOUT            ZB_MILLISECONDS_TO_BEACON_INTERVAL(3000) /**< Keepalive (parent poll) interval of the end device. */
+#endif
+#ifndef SWITCH_ED_AGING_TIMEOUT
+#define SWITCH_ED_AGING_TIMEOUT             ED_AGING_TIMEOUT_64MIN                   /**< End device timeout requested from the parent. */
+#endif
+#ifndef SWITCH_JOIN_RETRY_DELAY
+#define SWITCH_JOIN_RETRY_DELAY             ZB_TIME_ONE_SECOND                       /**< Delay before retrying to join after a failed network steering. */
+#endif
+#ifndef BATTERY_LEVEL_MEAS_TOLERANCE
+#define BATTERY_LEVEL_MEAS_TOLERANCE        (60 * ZB_TIME_ONE_SECOND)                /**< How long a due battery measurement may wait for another wakeup to run on. */
+#endif
+#ifndef SWITCH_WAKEUP_REPORT_INTERVAL
+#define SWITCH_WAKEUP_REPORT_INTERVAL       (3600 * ZB_TIME_ONE_SECOND)              /**< Interval between wakeup statistics log lines. */
+#endif
+#define SWITCH_WAKEUP_REPORT_TOLERANCE      (300 * ZB_TIME_ONE_SECOND)               /**< How long the wakeup statistics may wait for another wakeup to run on. */
+#ifndef SWITCH_NVRAM_COMMIT_DELAY
+#define SWITCH_NVRAM_COMMIT_DELAY           (5 * ZB_TIME_ONE_SECOND)                 /**< Quiet period after an attribute write before the persistent attributes are committed to flash. */
+#endif
+#define SWITCH_NVRAM_COMMIT_MAX_DELAY       (30 * ZB_TIME_ONE_SECOND)                /**< Longest a burst of attribute writes may postpone the commit. */
+
 
 /* Basic cluster attributes initial values. */
 #define BULB_INIT_BASIC_APP_VERSION       01                                    /**< Version of the application software (1 byte). */
@@ -91,7 +156,7 @@
 #define BULB_INIT_BASIC_HW_VERSION        11                                    /**< Version of the hardware of the device (1 byte). */
 #define BULB_INIT_BASIC_SW_VERSION        "5.45.1.17846"                                    /**< Version of the hardware of the device (1 byte). */
 #define BULB_INIT_BASIC_MANUF_NAME        "Philips"                              /**< Manufacturer name (32 bytes). */
-#define BULB_INIT_BASIC_MODEL_ID          "RWL021"                  /**< Model number assigned by manufacturer (32-bytes long string). */
+#define BULB_INIT_BASIC_MODEL_ID          SWITCH_PERSONALITY_MODEL_ID           /**< Model number assigned by manufacturer (32-bytes long string). */
 #define BULB_INIT_BASIC_DATE_CODE         "20180416"                            /**< First 8 bytes specify the date of manufacturer of the device in ISO 8601 format (YYYYMMDD). The rest (8 bytes) are manufacturer specific. */
 #define BULB_INIT_BASIC_POWER_SOURCE      ZB_ZCL_BASIC_POWER_SOURCE_BATTERY   /**< Type of power sources available for the device. For possible values see section 3.2.2.2.8 of ZCL specification. */
 #define BULB_INIT_BASIC_LOCATION_DESC     "Office desk"                         /**< Describes the physical location of the device (16 bytes). May be modified during commisioning process. */
@@ -100,20 +165,104 @@
 #define ZB_PHILIPS_MANUF_CODE             0x100b    // Not required
 #define RX_ON_IDLE                        ZB_FALSE  // Not required
 #define HARDWARE_VERSION                  0x0000
-#define BACKGROUND_DFU_DEFAULT_BLOCK_SIZE 64
-#define OTA_UPGRADE_TEST_DATA_SIZE        BACKGROUND_DFU_DEFAULT_BLOCK_SIZE
+
+/* OTA download. The OTA file is streamed into a download slot in flash, one page at a time. */
+#ifndef SWITCH_OTA_SLOT_START
+#define SWITCH_OTA_SLOT_START           0x80000                                 /**< Start of the download slot, the ota_slot region of the linker script. Set by OTA_SLOT_START in the Makefile. */
+#endif
+#ifndef SWITCH_OTA_SLOT_SIZE
+#define SWITCH_OTA_SLOT_SIZE            0x60000                                 /**< Size of the download slot, i.e. the largest OTA file accepted. Set by OTA_SLOT_SIZE in the Makefile. */
+#endif
+#define SWITCH_OTA_PAGE_SIZE            4096                                    /**< Flash page size - the image is erased and written a page at a time. */
+#define SWITCH_OTA_MAX_ASDU             82                                      /**< Largest APS payload from the parent in one frame: NWK security, no APS fragmentation. */
+#define SWITCH_OTA_BLOCK_RSP_OVERHEAD   (3 + 14)                                /**< ZCL header and the Image Block Response fields before the data. */
+#ifndef SWITCH_OTA_BLOCK_SIZE
+#define SWITCH_OTA_BLOCK_SIZE           ((SWITCH_OTA_MAX_ASDU - SWITCH_OTA_BLOCK_RSP_OVERHEAD) & ~3) /**< Largest block requested, the most that fits SWITCH_OTA_MAX_ASDU in whole words. The server may send smaller ones. */
+#endif
+#ifndef SWITCH_OTA_POLL_INTERVAL_MS
+#define SWITCH_OTA_POLL_INTERVAL_MS     250                                     /**< Long poll interval during a download - each block waits in the parent until the next poll. */
+#endif
+#define SWITCH_OTA_FLASH_DELAY_MS       20                                      /**< Delay of a flash step after the block that made it due, so the next Image Block Request is sent before the CPU stalls. */
+#define SWITCH_OTA_PAGE_ERASE_MS        85                                      /**< Longest page erase (tERASEPAGE), the CPU is stalled for it. */
+#define SWITCH_OTA_PAGE_WRITE_MS        42                                      /**< Longest write of a page, 1024 words of 41 us. */
+#ifndef SWITCH_OTA_CHECKPOINT_PAGES
+#define SWITCH_OTA_CHECKPOINT_PAGES     4                                       /**< Pages written to the download slot between two checkpoints in NVRAM. Each checkpoint appends the application dataset to the NVRAM log. */
+#endif
+#define SWITCH_OTA_TAG_SHA256           0xF000                                  /**< Manufacturer-specific tag closing the OTA file, holding the SHA-256 of everything before it. */
+#define SWITCH_OTA_TAG_SHA256_SIZE      (6 + 32)                                /**< Tag ID and length fields, and the digest. */
+
+/* Delta OTA images (see switch_ota_delta.h). The client queries the OTA server for the full image
+ * type, SWITCH_OTA_IMAGE_TYPE. Only once the server advertised a delta image for the switch in an
+ * Image Notify does the client query SWITCH_OTA_IMAGE_TYPE_DELTA, with its running file version.
+ * If the server has no delta built against that version, or the delta did not apply, the client
+ * goes back to the full image. */
+#ifndef SWITCH_OTA_IMAGE_TYPE
+#define SWITCH_OTA_IMAGE_TYPE           0x0000                                  /**< Image type of full OTA files. */
+#endif
+#ifndef SWITCH_OTA_IMAGE_TYPE_DELTA
+#define SWITCH_OTA_IMAGE_TYPE_DELTA     0x8001                                  /**< Image type of delta OTA files. */
+#endif
+#ifndef SWITCH_OTA_RUNNING_START
+#define SWITCH_OTA_RUNNING_START        0x0                                     /**< Start of the running application, the source of the COPY commands. */
+#endif
+#define SWITCH_OTA_RUNNING_SIZE         (SWITCH_OTA_SLOT_START - SWITCH_OTA_RUNNING_START)
 
 #define PHILIPS_BRIDGE_ZHA_ENDPOINT       0x41
+#ifndef PHILIPS_BRIDGE_SHORT_ADDR
+#define PHILIPS_BRIDGE_SHORT_ADDR         0x0001                                /**< Network address of the bridge, destination of the button events, battery reports and alarms. */
+#endif
 #define PHILIPS_BUTTON_EVENT_CMD_CODE 0x00
 
 #define ADC_REF_VOLTAGE_IN_MILLIVOLTS   600                                     /**< Reference voltage (in milli volts) used by ADC while doing conversion. */
 #define ADC_PRE_SCALING_COMPENSATION    6                                       /**< The ADC is configured to use VDD with 1/3 prescaling as input. And hence the result of conversion is to be multiplied by 3 to get the actual value of the battery voltage.*/
 #define DIODE_FWD_VOLT_DROP_MILLIVOLTS  270                                     /**< Typical forward voltage drop of the diode . */
-#define ADC_RES_10BIT                   1024                                    /**< Maximum digital value for 10-bit ADC conversion. */
-#define BATTERY_LEVEL_MEAS_INTERVAL     APP_TIMER_TICKS(300000)                 /**< Battery level measurement interval (ticks). This value corresponds to 300 seconds (5 minutes). */
+#define ADC_RESOLUTION                  NRF_SAADC_RESOLUTION_12BIT              /**< Conversion resolution. */
+#define ADC_RESOLUTION_BITS             (8 + 2 * ADC_RESOLUTION)                /**< Bits of a conversion result for ADC_RESOLUTION (8 bit ... 14 bit). */
+#define ADC_OVERSAMPLE                  NRF_SAADC_OVERSAMPLE_4X                 /**< Samples averaged into one result, taken in a single burst. */
+#define ADC_LOW_POWER_MODE              1                                       /**< The SAADC is started only for a conversion, and samples as soon as it has. */
+#define ADC_RES_MAX                     (1UL << ADC_RESOLUTION_BITS)            /**< Maximum digital value for the configured ADC resolution. */
+#define ADC_EMA_SHIFT                   2                                       /**< Weight of a new sample in the battery voltage filter is 1/2^ADC_EMA_SHIFT. */
+#define ADC_EMA_FRAC_BITS               4                                       /**< Fractional bits kept in the filtered battery voltage. */
+#define ADC_CALIBRATION_INTERVAL        12                                      /**< Number of measurements between SAADC offset calibrations (1 hour at the default interval). */
+#define BATTERY_MEAS_LOAD_MICROAMPS     3000                                    /**< Approximate current drawn from the battery while the measurement is taken (CPU and SAADC active). */
+#define BATTERY_REPORT_MIN_INTERVAL     3600                                    /**< Default minimum interval between battery reports (s). */
+#define BATTERY_REPORT_MAX_INTERVAL     43200                                   /**< Default maximum interval between battery reports, i.e. the heartbeat (s). */
+#define BATTERY_REPORT_VOLTAGE_DELTA    1                                       /**< Default reportable change of BatteryVoltage (100 mV units). */
+#define BATTERY_REPORT_REMAINING_DELTA  4                                       /**< Default reportable change of BatteryPercentageRemaining (0.5% units, i.e. 2%). */
+#define BATTERY_TX_LOAD_MICROAMPS       8000                                    /**< Approximate current drawn from the battery while the radio transmits at 0 dBm. */
+#ifndef BATTERY_MEAS_ON_TX_ENABLED
+#define BATTERY_MEAS_ON_TX_ENABLED      0                                       /**< Additionally sample the battery under load, triggered through PPI by the radio TXREADY event. */
+#endif
 
+
+
+#if BATTERY_MEAS_ON_TX_ENABLED && !ADC_LOW_POWER_MODE
+#error BATTERY_MEAS_ON_TX_ENABLED relies on the SAADC low power mode to sample after a PPI-triggered START.
+#endif
+
+/* Power configuration defaults for the fitted battery - a single CR2450 coin cell. */
+#define BULB_INIT_BATTERY_SIZE          ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER  /**< Battery size (coin cells have no dedicated ZCL value). */
+#define BULB_INIT_BATTERY_QUANTITY      1                                       /**< Number of battery cells in series. */
+#define BULB_INIT_BATTERY_RATED_VOLTAGE 30                                      /**< Rated voltage of a single cell in 100 mV units. */
+#define BULB_INIT_BATTERY_VOLTAGE_MIN   22                                      /**< BatteryVoltageMinThreshold in 100 mV units - the coin cell is effectively empty. */
+#define BULB_INIT_BATTERY_THRESHOLD1    26                                      /**< BatteryVoltageThreshold1 in 100 mV units. */
+#define BULB_INIT_BATTERY_THRESHOLD2    25                                      /**< BatteryVoltageThreshold2 in 100 mV units. */
+#define BULB_INIT_BATTERY_THRESHOLD3    24                                      /**< BatteryVoltageThreshold3 in 100 mV units. */
+#define BULB_INIT_BATTERY_ALARM_MASK    0x0F                                    /**< Alarms enabled for the min threshold and thresholds 1-3. */
+
+#define BATTERY_ALARM_CODE_BASE         0x10                                    /**< ZCL alarm code of the battery source 1 min threshold; thresholds 1-3 follow. */
+#define BATTERY_ALARM_CMD_CODE          0x00                                    /**< Alarms cluster 'Alarm' command. */
+#define BATTERY_LOW_POWER_ALARM_STATES  ( (1UL << 0) | (1UL << 3) )            /**< BatteryAlarmState bits (min threshold, threshold 3) that switch to the reduced-power profile. */
+
+/* Scale before dividing (rounded) so no resolution is lost to truncation. */
 #define ADC_RESULT_IN_MILLI_VOLTS(ADC_VALUE)\
-        ((((ADC_VALUE) * ADC_REF_VOLTAGE_IN_MILLIVOLTS) / ADC_RES_10BIT) * ADC_PRE_SCALING_COMPENSATION)
+        ((((zb_uint32_t)(ADC_VALUE) * ADC_REF_VOLTAGE_IN_MILLIVOLTS * ADC_PRE_SCALING_COMPENSATION) + (ADC_RES_MAX / 2)) / ADC_RES_MAX)
+
+#ifndef SWITCH_PROFILING_ENABLED
+#define SWITCH_PROFILING_ENABLED        0                                       /**< Measure the button/frame path with the DWT cycle counter and log the results. */
+#endif
+#define SWITCH_PROFILING_REPORT_INTERVAL (60 * ZB_TIME_ONE_SECOND)              /**< Interval between profiling reports. */
+#define SWITCH_PROFILING_REPORT_TOLERANCE (10 * ZB_TIME_ONE_SECOND)             /**< How long a due profiling report may wait for another wakeup to run on. */
 
 
 
@@ -121,6 +270,11 @@
 #error Define ZB_ED_ROLE to compile light switch (End Device) source code.
 #endif
 
+#if (SWITCH_BUILD_PROFILE != SWITCH_BUILD_PROFILE_FULL) && (SWITCH_BUILD_PROFILE != SWITCH_BUILD_PROFILE_ZHA) && \
+    (SWITCH_BUILD_PROFILE != SWITCH_BUILD_PROFILE_ZLL)
+#error Unknown SWITCH_BUILD_PROFILE.
+#endif
+
 typedef struct light_switch_button_s
 {
   zb_bool_t in_progress;
@@ -128,34 +282,146 @@ typedef struct light_switch_button_s
   zb_bool_t longHold;
   zb_uint8_t progressButtonId;
   zb_time_t timestamp;
-  zb_bool_t bufferInUse;
+  zb_uint8_t framesPending;
 } light_switch_button_t;
 
+/* Progress of an OTA download, kept in NVRAM so an interrupted download can be resumed. */
+typedef ZB_PACKED_PRE struct switch_ota_checkpoint_s
+{
+  zb_uint32_t file_version;
+  zb_uint32_t file_length;
+  zb_uint32_t offset;                   /**< Bytes of the file stored in the download slot, a whole number of pages. 0 if there is nothing to resume. */
+} ZB_PACKED_STRUCT switch_ota_checkpoint_t;
+
+/* Application dataset kept in the Zigbee NVRAM (ZB_NVRAM_APP_DATA1). The attribute fields hold
+ * the ZCL encoding of the attribute, see m_persistent_attrs. Fields are only ever appended, so a
+ * dataset written by another firmware version is restored up to the fields both know. */
+typedef ZB_PACKED_PRE struct switch_nvram_data_s
+{
+  switch_nvram_header_t header;         /**< SWITCH_NVRAM_DATA_VERSION and size of the dataset. */
+  zb_uint32_t battery_used_uah;
+  zb_uint32_t battery_estimate_q;
+  zb_char_t   location_id[15];
+  zb_uint8_t  ph_env;
+  zb_uint8_t  battery_size;
+  zb_uint8_t  battery_quantity;
+  zb_uint8_t  battery_rated_voltage;
+  zb_uint8_t  battery_alarm_mask;
+  zb_uint8_t  battery_voltage_min_threshold;
+  zb_uint8_t  battery_voltage_threshold1;
+  zb_uint8_t  battery_voltage_threshold2;
+  zb_uint8_t  battery_voltage_threshold3;
+  zb_uint8_t  battery_percentage_min_threshold;
+  zb_uint8_t  battery_percentage_threshold1;
+  zb_uint8_t  battery_percentage_threshold2;
+  zb_uint8_t  battery_percentage_threshold3;
+#if SWITCH_ZHA_EP_ENABLED
+  switch_ota_checkpoint_t ota;
+  sha256_context_t        ota_hash;     /**< Hash of the file up to ota.offset. */
+#endif
+} ZB_PACKED_STRUCT switch_nvram_data_t;
+
+ZB_ASSERT_COMPILE_DECL(sizeof(switch_nvram_data_t) % sizeof(zb_uint32_t) == 0);
+
+#define SWITCH_NVRAM_DATA_VERSION           1                                   /**< Bump when a field changes meaning. Datasets of any other version are ignored. */
 
+typedef struct wakeup_stats_s
+{
+  zb_uint32_t wakeups;                  /**< Times the device woke up from zb_sleep_now. */
+  zb_uint32_t coalesced;                /**< Deferrable work items run on a wakeup that was happening anyway. */
+  zb_uint32_t forced;                   /**< Deferrable work items that needed a wakeup of their own. */
+} wakeup_stats_t;
 
+typedef struct switch_ota_s
+{
+    zb_bool_t          active;          /**< A download is in progress - the device polls fast. */
+    zb_uint32_t        file_version;
+    zb_uint32_t        file_length;     /**< Size of the OTA file announced by the server. */
+    zb_uint32_t        received;        /**< Bytes received, i.e. the offset of the next block. */
+    zb_uint32_t        resumed_from;    /**< Offset the download was resumed from, 0 for a fresh one. */
+    zb_time_t          started_at;
+    zb_time_t          finished_at;     /**< Time the image was complete and verified, before the server's upgrade delay. */
+    zb_uint8_t         fill_buf;        /**< Page buffer receiving blocks. */
+    zb_uint16_t        fill_len;
+    zb_uint32_t        fill_addr;       /**< Flash address of the page being received. */
+    zb_uint32_t        erased_addr;     /**< End of the pages erased ahead of their write. */
+    zb_uint16_t        block_max;       /**< Largest block the server sent, for the download statistics. */
+    zb_bool_t          write_busy;      /**< The other page buffer is being written to flash. */
+    zb_bool_t          write_error;
+    zb_uint8_t         write_buf;
+    zb_uint16_t        write_len;
+    zb_uint32_t        write_addr;
+    zb_bool_t          finishing;       /**< All blocks received - the last page is being flushed. */
+    zb_uint8_t         paused_param;    /**< OTA callback buffer answered with BUSY, 0 if none. */
+    const zb_uint8_t * p_pending;       /**< Part of the current block not yet copied to a page buffer. */
+    zb_uint16_t        pending_len;
+    zb_uint32_t        image_length;    /**< Size of the OTA file built in the download slot. */
+    zb_bool_t          delta;           /**< The server sends a delta image, applied as it arrives. */
+    switch_ota_delta_t patch;           /**< Decoder of the delta image. */
+} switch_ota_t;
+
+typedef struct battery_meas_s
+{
+  zb_uint32_t filtered_mv;              /**< Filtered idle battery voltage in mV with ADC_EMA_FRAC_BITS fractional bits, 0 until the first sample. */
+  zb_uint32_t filtered_loaded_mv;       /**< Filtered battery voltage during radio TX, same format. */
+  zb_uint8_t meas_since_calibration;
+  zb_bool_t active;                     /**< The SAADC is initialized for the current measurement window. */
+  zb_bool_t calibrating;
+  volatile zb_bool_t calibration_done;  /**< Set in SAADC interrupt context, the conversion is set up again from the main loop. */
+  zb_bool_t sample_pending;             /**< Measurement requested while the offset calibration was running. */
+  volatile zb_bool_t tx_sample_armed;   /**< The next conversion is triggered by the radio through PPI. */
+  volatile zb_bool_t result_ready;      /**< Set in SAADC interrupt context, consumed in the main loop. */
+  volatile nrf_saadc_value_t result;
+  volatile zb_bool_t loaded_result_ready;
+  volatile nrf_saadc_value_t loaded_result;
+  zb_bool_t update_due;                 /**< The idle sample of the current window was filtered, the estimate is updated once the loaded sample is in or abandoned. */
+} battery_meas_t;
+
+
+
+/* State of the switch. There is a single instance, m_device_ctx: the ZBOSS attribute lists and
+ * device context are static and point into it, and so does m_persistent_attrs. The helpers take
+ * the instance they work on as p_ctx; only the entry points resolve m_device_ctx - ZBOSS alarm and
+ * buffer callbacks (the button hold and send callbacks among them), driver and BSP handlers, the
+ * initialization and the main loop. */
 typedef struct
 {
+#if SWITCH_ZLL_EP_ENABLED
     /* zll */
-    zb_zcl_basic_attrs_ext_hue_t    zll_basic_serv_attr;
-    zb_zcl_basic_attrs_ext_hue_t    zll_basic_client_attr;
-    zb_zcl_identify_attrs_t         zll_identify_attr;
-    zb_zcl_groups_attrs_t           zll_groups_attr;
-    zb_zcl_on_off_attrs_ext_t       zll_on_off_attr;
-    zb_zcl_level_control_attrs_t    zll_level_control_attr;
-    zb_zcl_scenes_attrs_t           zll_scenes_attr;
+    ZB_HA_HUE_ZLL_DIMMER_SWITCH_CLUSTERS( ZB_HA_HUE_ATTR_STORAGE )
+#endif
 
+#if SWITCH_ZHA_EP_ENABLED
     /* zha */
-    zb_zcl_basic_attrs_ext_hue_t    zha_basic_serv_attr;
+    ZB_HA_HUE_ZHA_DIMMER_SWITCH_CLUSTERS( ZB_HA_HUE_ATTR_STORAGE )
+#else
+    /* Battery state for the low-power profile - not exposed without the ZHA endpoint. */
     zb_zcl_power_config_attrs_ext_t zha_pwrconf_serv_attr;
-    zb_zcl_identify_attrs_t         zha_identify_serv_attr;
-    zb_zcl_binary_input_attrs_t     zha_binary_input_serv_attr;
-    zb_zcl_tunneling_attrs_t        zha_tunnelling_serv_attr;
-    ota_client_ota_upgrade_attr_t   zha_otau_attr;
+#endif
 
     /* other */
     light_switch_button_t           button;
+#if SWITCH_PERSONALITY_GREEN_POWER
+    zb_uint32_t                     gp_frame_counter;   /**< GPD frame counter of the next Green Power command. */
+#endif
+    battery_meas_t                  battery;
+    battery_charge_t                charge;
+    wakeup_stats_t                  wakeup;
     zb_addr_u                       bridge_short_addr;
     zb_bool_t                       nwk_joined;
+    zb_bool_t                       low_power;          /**< Reduced-power profile, entered when the battery nears end of life. */
+    zb_uint32_t                     saved_poll_interval_ms; /**< Long poll interval of the stack to restore once no mode overrides it, 0 while none does. */
+    zb_bool_t                       nvram_commit_pending;
+    zb_bool_t                       nvram_dirty;        /**< Data outside the persistent attributes (the battery estimate) changed since the last commit. */
+    zb_time_t                       nvram_dirty_since;  /**< Time of the first change not yet committed. */
+    zb_uint32_t                     nvram_commits;      /**< Attribute commits since boot, to keep an eye on flash wear. */
+#if SWITCH_ZHA_EP_ENABLED
+    switch_ota_t                    ota;
+    switch_ota_checkpoint_t         ota_checkpoint;
+    sha256_context_t                ota_hash;           /**< Hash of the pages written to the download slot. */
+    zb_uint32_t                     ota_ready_version;  /**< Version of the image completed in the download slot, waiting for the bootloader. */
+    zb_uint32_t                     ota_delta_failed_version; /**< Version of the last delta image that did not apply, its full image is downloaded instead. */
+#endif
 
     
 
@@ -163,42 +429,171 @@ typedef struct
 
 static switch_ctx_t m_device_ctx;
 
-static nrf_saadc_value_t adc_buf[2];
+static nrf_saadc_value_t adc_buf;
+
+#if BATTERY_MEAS_ON_TX_ENABLED
+static nrf_ppi_channel_t m_battery_ppi_channel;         /**< Connects RADIO TXREADY to SAADC START. */
+#endif
+
+
+static zb_void_t battery_level_meas_timeout_handler(zb_uint8_t param);
+static void battery_alarm_evaluate(switch_ctx_t * p_ctx, zb_uint16_t battery_mv, zb_uint8_t remaining);
+
+#if SWITCH_PROFILING_ENABLED
+/* Probes on the button/frame hot path. Each probe accumulates the DWT cycle count of the code
+ * between SWITCH_PROFILE_START and SWITCH_PROFILE_STOP. */
+typedef enum
+{
+    SWITCH_PROFILE_BUTTONS_HANDLER,
+    SWITCH_PROFILE_BUTTON_INFO_ENCODE,
+    SWITCH_PROFILE_BUTTON_INFO_DECODE,
+    SWITCH_PROFILE_EVENT_DATA,
+    SWITCH_PROFILE_FRAME_BUILD,
+    SWITCH_PROFILE_ALARM_SCHEDULE,
+    SWITCH_PROFILE_ALARM_CANCEL,
+    SWITCH_PROFILE_OTA_HASH,
+    SWITCH_PROFILE_OTA_PAGE_WRITE,
+    SWITCH_PROFILE_OTA_PAGE_ERASE,
+    SWITCH_PROFILE_COUNT
+} switch_profile_id_t;
+
+typedef struct
+{
+    zb_uint32_t start;
+    zb_uint32_t count;
+    zb_uint32_t min;
+    zb_uint32_t max;
+    zb_uint64_t total;
+} switch_profile_probe_t;
+
+static const char * const m_profile_names[SWITCH_PROFILE_COUNT] =
+{
+    "buttons_handler",
+    "button_info_encode",
+    "button_info_decode",
+    "event_data",
+    "frame_build",
+    "alarm_schedule",
+    "alarm_cancel",
+    "ota_hash",
+    "ota_page_write",
+    "ota_page_erase",
+};
+
+static switch_profile_probe_t m_profile_probes[SWITCH_PROFILE_COUNT];
+
+#define SWITCH_PROFILE_START( id ) ( m_profile_probes[id].start = DWT->CYCCNT )
+#define SWITCH_PROFILE_STOP( id )  switch_profile_record( id, DWT->CYCCNT )
+
+/**@brief Function for enabling the DWT cycle counter used by the profiling probes.
+ */
+static void switch_profile_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    for (zb_uint8_t i = 0; i < SWITCH_PROFILE_COUNT; i++)
+    {
+        m_profile_probes[i].min = UINT32_MAX;
+    }
+}
+
+static void switch_profile_record(switch_profile_id_t id, zb_uint32_t now)
+{
+    switch_profile_probe_t * p_probe = &m_profile_probes[id];
+    zb_uint32_t              cycles  = now - p_probe->start;
 
-APP_TIMER_DEF(m_battery_timer_id);                      /**< Battery measurement timer. */
+    p_probe->count++;
+    p_probe->total += cycles;
+    p_probe->min    = MIN(p_probe->min, cycles);
+    p_probe->max    = MAX(p_probe->max, cycles);
+}
 
-static void battery_level_meas_timeout_handler(void * p_context);
+/**@brief Function for logging the profiling results.
+ *
+ * @details One line per probe, in the form "PROF,<probe>,<count>,<min>,<max>,<avg>" with all
+ *          times in CPU cycles, so that the log can be collected and compared against a
+ *          previous run.
+ */
+static zb_void_t switch_profile_report(zb_uint8_t param)
+{
+    UNUSED_PARAMETER(param);
+
+    for (zb_uint8_t i = 0; i < SWITCH_PROFILE_COUNT; i++)
+    {
+        switch_profile_probe_t * p_probe = &m_profile_probes[i];
+
+        if (p_probe->count == 0)
+        {
+            continue;
+        }
+        NRF_LOG_INFO( "PROF,%s,%u,%u,%u,%u", m_profile_names[i], p_probe->count, p_probe->min,
+                      p_probe->max, (zb_uint32_t)( p_probe->total / p_probe->count ) );
+    }
+}
+#else
+#define SWITCH_PROFILE_START( id )
+#define SWITCH_PROFILE_STOP( id )
+#endif
 
 //static zb_void_t find_light_bulb(zb_uint8_t param);
 
+/* Basic cluster attributes that never change, shared by all endpoints. The attribute lists only
+ * read them, as they are declared read-only. */
+ZB_ZCL_DECLARE_BASIC_CONST_ATTRS_TYPE( switch_basic_const_attrs_t,
+                                       BULB_INIT_BASIC_MANUF_NAME,
+                                       BULB_INIT_BASIC_MODEL_ID,
+                                       BULB_INIT_BASIC_DATE_CODE,
+                                       BULB_INIT_BASIC_SW_VERSION );
+
+static const switch_basic_const_attrs_t m_basic_const_attrs =
+{
+    .zcl_version   = ZB_ZCL_VERSION,
+    .app_version   = BULB_INIT_BASIC_APP_VERSION,
+    .stack_version = BULB_INIT_BASIC_STACK_VERSION,
+    .hw_version    = BULB_INIT_BASIC_HW_VERSION,
+    .power_source  = BULB_INIT_BASIC_POWER_SOURCE,
+    .mf_name       = ZB_ZCL_CONST_STRING_INIT( BULB_INIT_BASIC_MANUF_NAME ),
+    .model_id      = ZB_ZCL_CONST_STRING_INIT( BULB_INIT_BASIC_MODEL_ID ),
+    .date_code     = ZB_ZCL_CONST_STRING_INIT( BULB_INIT_BASIC_DATE_CODE ),
+    .sw_ver        = ZB_ZCL_CONST_STRING_INIT( BULB_INIT_BASIC_SW_VERSION ),
+};
+
+ZB_ASSERT_COMPILE_DECL(sizeof(BULB_INIT_BASIC_MANUF_NAME) - 1 <= 32);
+ZB_ASSERT_COMPILE_DECL(sizeof(BULB_INIT_BASIC_MODEL_ID) - 1 <= 32);
+ZB_ASSERT_COMPILE_DECL(sizeof(BULB_INIT_BASIC_DATE_CODE) - 1 <= 16);
+ZB_ASSERT_COMPILE_DECL(sizeof(BULB_INIT_BASIC_SW_VERSION) - 1 <= 16);
+
+#if SWITCH_ZLL_EP_ENABLED
 /* ZLL Cluster list declarations */
 ZB_ZCL_DECLARE_BASIC_ATTRIB_LIST_EXT( zll_basic_serv_attr_list,
-                                      &m_device_ctx.zll_basic_serv_attr.zcl_version,
-                                      &m_device_ctx.zll_basic_serv_attr.app_version,
-                                      &m_device_ctx.zll_basic_serv_attr.stack_version,
-                                      &m_device_ctx.zll_basic_serv_attr.hw_version,
-                                      m_device_ctx.zll_basic_serv_attr.mf_name,
-                                      m_device_ctx.zll_basic_serv_attr.model_id,
-                                      m_device_ctx.zll_basic_serv_attr.date_code,
-                                      &m_device_ctx.zll_basic_serv_attr.power_source,
+                                      &m_basic_const_attrs.zcl_version,
+                                      &m_basic_const_attrs.app_version,
+                                      &m_basic_const_attrs.stack_version,
+                                      &m_basic_const_attrs.hw_version,
+                                      &m_basic_const_attrs.mf_name,
+                                      &m_basic_const_attrs.model_id,
+                                      &m_basic_const_attrs.date_code,
+                                      &m_basic_const_attrs.power_source,
                                       m_device_ctx.zll_basic_serv_attr.location_id,
                                       &m_device_ctx.zll_basic_serv_attr.ph_env,
-                                      m_device_ctx.zll_basic_serv_attr.sw_ver,
+                                      &m_basic_const_attrs.sw_ver,
                                       &m_device_ctx.zll_basic_serv_attr.philips_device_flag,
                                       &m_device_ctx.zll_basic_serv_attr.philips_en_flag );
 
 ZB_ZCL_DECLARE_BASIC_ATTRIB_LIST_EXT( zll_basic_client_attr_list,
-                                      &m_device_ctx.zll_basic_client_attr.zcl_version,
-                                      &m_device_ctx.zll_basic_client_attr.app_version,
-                                      &m_device_ctx.zll_basic_client_attr.stack_version,
-                                      &m_device_ctx.zll_basic_client_attr.hw_version,
-                                      m_device_ctx.zll_basic_client_attr.mf_name,
-                                      m_device_ctx.zll_basic_client_attr.model_id,
-                                      m_device_ctx.zll_basic_client_attr.date_code,
-                                      &m_device_ctx.zll_basic_client_attr.power_source,
+                                      &m_basic_const_attrs.zcl_version,
+                                      &m_basic_const_attrs.app_version,
+                                      &m_basic_const_attrs.stack_version,
+                                      &m_basic_const_attrs.hw_version,
+                                      &m_basic_const_attrs.mf_name,
+                                      &m_basic_const_attrs.model_id,
+                                      &m_basic_const_attrs.date_code,
+                                      &m_basic_const_attrs.power_source,
                                       m_device_ctx.zll_basic_client_attr.location_id,
                                       &m_device_ctx.zll_basic_client_attr.ph_env,
-                                      m_device_ctx.zll_basic_client_attr.sw_ver,
+                                      &m_basic_const_attrs.sw_ver,
                                       &m_device_ctx.zll_basic_client_attr.philips_device_flag,
                                       &m_device_ctx.zll_basic_client_attr.philips_en_flag );
 
@@ -223,22 +618,22 @@ ZB_ZCL_DECLARE_SCENES_ATTRIB_LIST( zll_scenes_attr_list,
                                    &m_device_ctx.zll_scenes_attr.current_group,
                                    &m_device_ctx.zll_scenes_attr.scene_valid,
                                    &m_device_ctx.zll_scenes_attr.name_support);
+#endif
 
-
+#if SWITCH_ZHA_EP_ENABLED
 /* ZHA Cluster list declarations */
-
 ZB_ZCL_DECLARE_BASIC_ATTRIB_LIST_EXT( zha_basic_serv_attr_list,
-                                      &m_device_ctx.zha_basic_serv_attr.zcl_version,
-                                      &m_device_ctx.zha_basic_serv_attr.app_version,
-                                      &m_device_ctx.zha_basic_serv_attr.stack_version,
-                                      &m_device_ctx.zha_basic_serv_attr.hw_version,
-                                      m_device_ctx.zha_basic_serv_attr.mf_name,
-                                      m_device_ctx.zha_basic_serv_attr.model_id,
-                                      m_device_ctx.zha_basic_serv_attr.date_code,
-                                      &m_device_ctx.zha_basic_serv_attr.power_source,
+                                      &m_basic_const_attrs.zcl_version,
+                                      &m_basic_const_attrs.app_version,
+                                      &m_basic_const_attrs.stack_version,
+                                      &m_basic_const_attrs.hw_version,
+                                      &m_basic_const_attrs.mf_name,
+                                      &m_basic_const_attrs.model_id,
+                                      &m_basic_const_attrs.date_code,
+                                      &m_basic_const_attrs.power_source,
                                       m_device_ctx.zha_basic_serv_attr.location_id,
                                       &m_device_ctx.zha_basic_serv_attr.ph_env,
-                                      m_device_ctx.zha_basic_serv_attr.sw_ver,
+                                      &m_basic_const_attrs.sw_ver,
                                       &m_device_ctx.zha_basic_serv_attr.philips_device_flag,
                                       &m_device_ctx.zha_basic_serv_attr.philips_en_flag );
 
@@ -267,7 +662,7 @@ ZB_ZCL_DECLARE_BINARY_INPUT_ATTRIB_LIST( zha_binary_input_serv_attr_list,
                                          &m_device_ctx.zha_binary_input_serv_attr.present_value,
                                          &m_device_ctx.zha_binary_input_serv_attr.status_flag );
 
-ZB_ZCL_DECLARE_TUNNELING_ATTR_LIST( zha_tunnel_serv_attr_list, m_device_ctx.zha_tunnelling_serv_attr );
+ZB_ZCL_DECLARE_TUNNELING_ATTR_LIST( zha_tunnel_serv_attr_list, m_device_ctx.zha_tunnel_serv_attr );
 
 /* OTA cluster attributes data */
 ZB_ZCL_DECLARE_OTA_UPGRADE_ATTRIB_LIST( zha_otau_attr_list,
@@ -285,45 +680,46 @@ ZB_ZCL_DECLARE_OTA_UPGRADE_ATTRIB_LIST( zha_otau_attr_list,
                                         &m_device_ctx.zha_otau_attr.server_addr,
                                         &m_device_ctx.zha_otau_attr.server_ep,
                                         HARDWARE_VERSION,
-                                        OTA_UPGRADE_TEST_DATA_SIZE,
+                                        SWITCH_OTA_BLOCK_SIZE,
                                         ZB_ZCL_OTA_UPGRADE_QUERY_TIMER_COUNT_DEF );
 
+#endif
+
+#if SWITCH_ZLL_EP_ENABLED
 /* Declare cluster list for Dimmer Switch device (Identify, Basic, Scenes, Groups, On Off, Level Control). */
 /* Only clusters Identify and Basic have attributes. */
-ZB_HA_HUE_ZLL_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( dimmer_switch_zll_clusters,
-                                                  zll_basic_serv_attr_list,
-                                                  zll_basic_client_attr_list,
-                                                  zll_identify_attr_list,
-                                                  zll_groups_attr_list,       
-                                                  zll_on_off_attr_list,       
-                                                  zll_level_control_attr_list,
-                                                  zll_scenes_attr_list );
-
-ZB_HA_HUE_ZHA_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( dimmer_switch_zha_clusters,
-                                                  zha_basic_serv_attr_list,
-                                                  zha_pwrconf_serv_attr_list,
-                                                  zha_identify_serv_attr_list,
-                                                  zha_binary_input_serv_attr_list,
-                                                  zha_tunnel_serv_attr_list,
-                                                  zha_otau_attr_list );
+ZB_HA_HUE_ZLL_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( dimmer_switch_zll_clusters );
 
 /* Declare endpoint for Dimmer Switch device. */
 ZB_HA_HUE_ZLL_DECLARE_DIMMER_SWITCH_EP( dimmer_switch_zll_ep,
                                         LIGHT_SWITCH_ZLL_ENDPOINT,
                                         dimmer_switch_zll_clusters );
+#endif
+
+#if SWITCH_ZHA_EP_ENABLED
+/* Declare cluster list for the ZHA endpoint (Basic, Power Config, Identify, Binary Input, FC00, OTA). */
+ZB_HA_HUE_ZHA_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( dimmer_switch_zha_clusters );
 
 ZB_HA_HUE_ZHA_DECLARE_DIMMER_SWITCH_EP( dimmer_switch_zha_ep,
                                         LIGHT_SWITCH_ZHA_ENDPOINT,
                                         dimmer_switch_zha_clusters );
+#endif
 
 /* Declare application's device context (list of registered endpoints) for Dimmer Switch device. */
+#if SWITCH_BUILD_PROFILE == SWITCH_BUILD_PROFILE_ZHA
+ZB_HA_HUE_DECLARE_DIMMER_SWITCH_CTX_1_EP( dimmer_switch_ctx, dimmer_switch_zha_ep );
+#elif SWITCH_BUILD_PROFILE == SWITCH_BUILD_PROFILE_ZLL
+ZB_HA_HUE_DECLARE_DIMMER_SWITCH_CTX_1_EP( dimmer_switch_ctx, dimmer_switch_zll_ep );
+#else
 ZB_HA_HUE_DECLARE_DIMMER_SWITCH_CTX( dimmer_switch_ctx,
                                      dimmer_switch_zll_ep,
                                      dimmer_switch_zha_ep );
+#endif
 
 /**@brief Function for the Timer initialization.
  *
- * @details Initializes the timer module. This creates and starts application timers.
+ * @details Initializes the timer module, used by the BSP. Periodic application work is run from
+ *          the deferrable work table instead (see switch_deferred_run).
  */
 static void timers_init(void)
 {
@@ -332,26 +728,862 @@ static void timers_init(void)
     // Initialize timer module.
     err_code = app_timer_init();
     APP_ERROR_CHECK(err_code);
-
-    // Create battery timer.
-    NRF_LOG_INFO( "Create battery timer" );
-    err_code = app_timer_create(&m_battery_timer_id,
-                                APP_TIMER_MODE_REPEATED,
-                                battery_level_meas_timeout_handler);
-    APP_ERROR_CHECK(err_code);
 }
 
+#if NRF_LOG_BACKEND_RTT_ENABLED
+NRF_LOG_BACKEND_RTT_DEF(m_log_backend_rtt);
+#endif
+#if NRF_LOG_BACKEND_UART_ENABLED
+NRF_LOG_BACKEND_UART_DEF(m_log_backend_uart);
+#endif
+
+#define SWITCH_LOG_BACKENDS_ENABLED (NRF_LOG_ENABLED && (NRF_LOG_BACKEND_RTT_ENABLED || NRF_LOG_BACKEND_UART_ENABLED))
+
+#if SWITCH_LOG_BACKENDS_ENABLED
+/* Log backends added by log_init. The runtime log level is applied to each of them. */
+static nrf_log_backend_t const * const m_log_backends[] =
+{
+#if NRF_LOG_BACKEND_RTT_ENABLED
+    &m_log_backend_rtt,
+#endif
+#if NRF_LOG_BACKEND_UART_ENABLED
+    &m_log_backend_uart,
+#endif
+};
+#endif
+
 /**@brief Function for initializing the nrf log module.
+ *
+ * @details The backends are added here rather than with NRF_LOG_DEFAULT_BACKENDS_INIT, so that
+ *          switch_log_level_limit can address them.
  */
 static void log_init(void)
 {
     ret_code_t err_code = NRF_LOG_INIT(NULL);
     APP_ERROR_CHECK(err_code);
 
-    NRF_LOG_DEFAULT_BACKENDS_INIT();
+#if NRF_LOG_BACKEND_RTT_ENABLED
+    nrf_log_backend_rtt_init();
+#endif
+#if NRF_LOG_BACKEND_UART_ENABLED
+    nrf_log_backend_uart_init();
+#endif
+
+#if SWITCH_LOG_BACKENDS_ENABLED
+    for (zb_uint8_t i = 0; i < ARRAY_SIZE(m_log_backends); i++)
+    {
+        int32_t backend_id = nrf_log_backend_add(m_log_backends[i], NRF_LOG_SEVERITY_DEBUG);
+        ASSERT(backend_id >= 0);
+        UNUSED_VARIABLE(backend_id);
+        nrf_log_backend_enable(m_log_backends[i]);
+    }
+#endif
+}
+
+
+
+#define SWITCH_PERSISTENT_ATTR( endpoint, cluster_id, attr_id, p_value, field )                \
+    SWITCH_NVRAM_ATTR( switch_nvram_data_t, endpoint, cluster_id, attr_id, p_value, field )
+
+/* The Basic attributes are persisted for the endpoint the bridge or installer talks to. */
+#if SWITCH_ZHA_EP_ENABLED
+#define SWITCH_PERSISTENT_BASIC_EP          LIGHT_SWITCH_ZHA_ENDPOINT
+#define SWITCH_PERSISTENT_BASIC_ATTR        m_device_ctx.zha_basic_serv_attr
+#else
+#define SWITCH_PERSISTENT_BASIC_EP          LIGHT_SWITCH_ZLL_ENDPOINT
+#define SWITCH_PERSISTENT_BASIC_ATTR        m_device_ctx.zll_basic_serv_attr
+#endif
+
+static const switch_persistent_attr_t m_persistent_attrs[] =
+{
+    SWITCH_PERSISTENT_ATTR( SWITCH_PERSISTENT_BASIC_EP, ZB_ZCL_CLUSTER_ID_BASIC, ZB_ZCL_ATTR_BASIC_LOCATION_DESCRIPTION_ID,
+                            SWITCH_PERSISTENT_BASIC_ATTR.location_id, location_id ),
+    SWITCH_PERSISTENT_ATTR( SWITCH_PERSISTENT_BASIC_EP, ZB_ZCL_CLUSTER_ID_BASIC, ZB_ZCL_ATTR_BASIC_PHYSICAL_ENVIRONMENT_ID,
+                            &SWITCH_PERSISTENT_BASIC_ATTR.ph_env, ph_env ),
+#if SWITCH_ZHA_EP_ENABLED
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_SIZE_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.size, battery_size ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_QUANTITY_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.quantity, battery_quantity ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_RATED_VOLTAGE_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.rated_voltage, battery_rated_voltage ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_ALARM_MASK_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.alarm_mask, battery_alarm_mask ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_VOLTAGE_MIN_THRESHOLD_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.voltage_min_threshold, battery_voltage_min_threshold ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_VOLTAGE_THRESHOLD1_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.threshold1, battery_voltage_threshold1 ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_VOLTAGE_THRESHOLD2_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.threshold2, battery_voltage_threshold2 ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_VOLTAGE_THRESHOLD3_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.threshold3, battery_voltage_threshold3 ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_PERCENTAGE_MIN_THRESHOLD_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.min_threshold, battery_percentage_min_threshold ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_PERCENTAGE_THRESHOLD1_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.percent_threshold1, battery_percentage_threshold1 ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_PERCENTAGE_THRESHOLD2_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.percent_threshold2, battery_percentage_threshold2 ),
+    SWITCH_PERSISTENT_ATTR( LIGHT_SWITCH_ZHA_ENDPOINT, ZB_ZCL_CLUSTER_ID_POWER_CONFIG, ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_PERCENTAGE_THRESHOLD3_ID,
+                            &m_device_ctx.zha_pwrconf_serv_attr.percent_threshold3, battery_percentage_threshold3 ),
+#endif
+};
+
+static switch_nvram_data_t m_nvram_data;                /**< Application dataset as last read from or written to NVRAM. */
+
+/**@brief Function for committing the application dataset to NVRAM, if any of it changed.
+ */
+static zb_void_t switch_nvram_commit(zb_uint8_t param)
+{
+    switch_ctx_t * p_ctx   = &m_device_ctx;
+    zb_bool_t      changed = p_ctx->nvram_dirty;
+
+    UNUSED_PARAMETER(param);
+    p_ctx->nvram_commit_pending = ZB_FALSE;
+    p_ctx->nvram_dirty          = ZB_FALSE;
+
+    if (!changed)
+    {
+        changed = switch_nvram_attrs_changed( m_persistent_attrs, ARRAY_SIZE(m_persistent_attrs), &m_nvram_data );
+    }
+
+    if (!changed)
+    {
+        return;
+    }
+
+    NRF_LOG_INFO( "Committing application NVRAM data (%u since boot)", ++p_ctx->nvram_commits );
+    UNUSED_RETURN_VALUE(zb_nvram_write_dataset(ZB_NVRAM_APP_DATA1));
+}
+
+/**@brief Function for scheduling the commit of the application dataset.
+ *
+ * @details Each flash write appends the whole dataset to the NVRAM log, and a full NVRAM page
+ *          costs a page erase. Writes are therefore coalesced: the commit follows
+ *          SWITCH_NVRAM_COMMIT_DELAY after the last change of a burst, but is not postponed for
+ *          more than SWITCH_NVRAM_COMMIT_MAX_DELAY after the first one. The flash write blocks
+ *          the stack for its duration, which is why it is not done where the change is made.
+ *
+ * @param[in]   p_ctx   Switch whose dataset changed.
+ */
+static void switch_nvram_commit_schedule(switch_ctx_t * p_ctx)
+{
+    zb_time_t now = ZB_TIMER_GET();
+    zb_ret_t  zb_err_code;
+
+    if (!p_ctx->nvram_commit_pending)
+    {
+        p_ctx->nvram_commit_pending = ZB_TRUE;
+        p_ctx->nvram_dirty_since    = now;
+    }
+    else if (ZB_TIME_SUBTRACT( now, p_ctx->nvram_dirty_since ) + SWITCH_NVRAM_COMMIT_DELAY > SWITCH_NVRAM_COMMIT_MAX_DELAY)
+    {
+        /* Keep the commit already scheduled. */
+        return;
+    }
+
+    UNUSED_RETURN_VALUE(ZB_SCHEDULE_ALARM_CANCEL( switch_nvram_commit, ZB_ALARM_ANY_PARAM ));
+    zb_err_code = ZB_SCHEDULE_ALARM( switch_nvram_commit, 0, SWITCH_NVRAM_COMMIT_DELAY );
+    ZB_ERROR_CHECK( zb_err_code );
+}
+
+/**@brief Function for scheduling the commit of a written attribute, if it is persistent.
+ *
+ * @details m_persistent_attrs points into m_device_ctx, the only instance.
+ *
+ * @param[in]   p_ctx        Switch the attribute belongs to.
+ * @param[in]   endpoint     Endpoint of the written attribute.
+ * @param[in]   cluster_id   Cluster of the written attribute.
+ * @param[in]   attr_id      Written attribute.
+ */
+static void switch_persistent_attr_written(switch_ctx_t * p_ctx, zb_uint8_t endpoint, zb_uint16_t cluster_id, zb_uint16_t attr_id)
+{
+    if (switch_nvram_attr_find( m_persistent_attrs, ARRAY_SIZE(m_persistent_attrs), endpoint, cluster_id, attr_id ) == NULL)
+    {
+        return;
+    }
+
+    switch_nvram_commit_schedule(p_ctx);
+}
+
+/**@brief Function for applying the long poll interval of the current operating mode.
+ *
+ * @details An OTA download polls fast, as every image block waits in the parent until the next
+ *          poll. Otherwise the reduced-power profile polls less often than normal. The interval
+ *          the stack used before the first override is saved, and put back once neither applies.
+ */
+static void switch_poll_interval_update(switch_ctx_t * p_ctx)
+{
+    zb_uint32_t interval_ms = p_ctx->low_power ? SWITCH_LOW_POWER_POLL_INTERVAL_MS : 0;
+
+#if SWITCH_ZHA_EP_ENABLED
+    if (p_ctx->ota.active)
+    {
+        interval_ms = SWITCH_OTA_POLL_INTERVAL_MS;
+    }
+#endif
+
+    if (interval_ms == 0)
+    {
+        if (p_ctx->saved_poll_interval_ms == 0)
+        {
+            return;
+        }
+        interval_ms = p_ctx->saved_poll_interval_ms;
+        p_ctx->saved_poll_interval_ms = 0;
+    }
+    else if (p_ctx->saved_poll_interval_ms == 0)
+    {
+        p_ctx->saved_poll_interval_ms = zb_zdo_get_poll_interval_ms();
+    }
+
+    zb_zdo_pim_set_long_poll_interval(interval_ms);
+}
+
+#if SWITCH_ZHA_EP_ENABLED
+static void switch_ota_fstorage_evt_handler(nrf_fstorage_evt_t * p_evt);
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t m_ota_fstorage) =
+{
+    .evt_handler = switch_ota_fstorage_evt_handler,
+    .start_addr  = SWITCH_OTA_SLOT_START,
+    .end_addr    = SWITCH_OTA_SLOT_START + SWITCH_OTA_SLOT_SIZE - 1,
+};
+
+/* Two page buffers - blocks are received into one while the other waits for its flash write. */
+static zb_uint8_t m_ota_page[2][SWITCH_OTA_PAGE_SIZE] __ALIGN(4);
+
+ZB_ASSERT_COMPILE_DECL(SWITCH_OTA_SLOT_START % SWITCH_OTA_PAGE_SIZE == 0);
+ZB_ASSERT_COMPILE_DECL(SWITCH_OTA_SLOT_SIZE % SWITCH_OTA_PAGE_SIZE == 0);
+ZB_ASSERT_COMPILE_DECL(SWITCH_OTA_BLOCK_SIZE + SWITCH_OTA_BLOCK_RSP_OVERHEAD <= SWITCH_OTA_MAX_ASDU);
+/* A page write and the erase of the next page both fit between two polls. */
+ZB_ASSERT_COMPILE_DECL(SWITCH_OTA_FLASH_DELAY_MS + SWITCH_OTA_PAGE_WRITE_MS + SWITCH_OTA_PAGE_ERASE_MS < SWITCH_OTA_POLL_INTERVAL_MS);
+
+/**@brief Function for adding a page of the OTA file to the image hash.
+ *
+ * @details Pages are hashed as they are handed to flash, so the hash state always matches the
+ *          part of the file in the download slot and is saved along with the checkpoint. The
+ *          closing SHA-256 tag is left out.
+ */
+static void switch_ota_hash_page(switch_ctx_t * p_ctx, const zb_uint8_t * p_page, zb_uint32_t offset, zb_uint16_t len)
+{
+    zb_uint32_t hash_end = p_ctx->ota.image_length - SWITCH_OTA_TAG_SHA256_SIZE;
+
+    if (offset >= hash_end)
+    {
+        return;
+    }
+
+    SWITCH_PROFILE_START( SWITCH_PROFILE_OTA_HASH );
+    UNUSED_RETURN_VALUE(sha256_update(&p_ctx->ota_hash, p_page, MIN(len, hash_end - offset)));
+    SWITCH_PROFILE_STOP( SWITCH_PROFILE_OTA_HASH );
+}
+
+/**@brief Function for checking the image hash against the SHA-256 tag closing the OTA file.
+ *
+ * @details Only the tag is read back from flash, the file itself was hashed on the way in.
+ */
+static zb_uint8_t switch_ota_verify(switch_ctx_t * p_ctx)
+{
+    const zb_uint8_t * p_tag = (const zb_uint8_t *)SWITCH_OTA_SLOT_START + p_ctx->ota.image_length - SWITCH_OTA_TAG_SHA256_SIZE;
+    zb_uint8_t         digest[32];
+
+    if (p_tag[0] != ZB_GET_LOW_BYTE(SWITCH_OTA_TAG_SHA256) || p_tag[1] != ZB_GET_HI_BYTE(SWITCH_OTA_TAG_SHA256) ||
+        p_tag[2] != sizeof(digest) || p_tag[3] != 0 || p_tag[4] != 0 || p_tag[5] != 0)
+    {
+        NRF_LOG_WARNING( "OTA file does not end with a SHA-256 tag" );
+        return ZB_ZCL_OTA_UPGRADE_STATUS_ERROR;
+    }
+
+    UNUSED_RETURN_VALUE(sha256_final(&p_ctx->ota_hash, digest, 0));
+    if (ZB_MEMCMP( digest, &p_tag[6], sizeof(digest) ) != 0)
+    {
+        NRF_LOG_WARNING( "OTA image hash mismatch" );
+        return ZB_ZCL_OTA_UPGRADE_STATUS_ERROR;
+    }
+
+    NRF_LOG_INFO( "OTA image hash verified" );
+    return ZB_ZCL_OTA_UPGRADE_STATUS_OK;
+}
+
+/**@brief Function for erasing the page being received into, ahead of its write.
+ *
+ * @details Runs as a step of its own after the write of the previous page, so that each step
+ *          stalls the CPU for one page operation only, and while the blocks of the page are still
+ *          to come.
+ */
+static zb_void_t switch_ota_page_erase(zb_uint8_t param)
+{
+    switch_ctx_t * p_ctx = &m_device_ctx;
+    switch_ota_t * p_ota = &p_ctx->ota;
+    ret_code_t     err_code;
+
+    UNUSED_PARAMETER(param);
+
+    if (!p_ota->active || p_ota->erased_addr > p_ota->fill_addr ||
+        p_ota->fill_addr >= SWITCH_OTA_SLOT_START + SWITCH_OTA_SLOT_SIZE)
+    {
+        return;
+    }
+
+    SWITCH_PROFILE_START( SWITCH_PROFILE_OTA_PAGE_ERASE );
+    err_code = nrf_fstorage_erase(&m_ota_fstorage, p_ota->fill_addr, 1, NULL);
+    SWITCH_PROFILE_STOP( SWITCH_PROFILE_OTA_PAGE_ERASE );
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING( "OTA flash erase at 0x%x failed, error %d", p_ota->fill_addr, err_code );
+        p_ota->write_error = ZB_TRUE;
+        return;
+    }
+    p_ota->erased_addr = p_ota->fill_addr + SWITCH_OTA_PAGE_SIZE;
+}
+
+/**@brief Function for scheduling the next flash step of the download.
+ *
+ * @details The OTA client sends the next Image Block Request once the callback of the current
+ *          block returns, and its response waits in the parent until the next poll. A step
+ *          delayed by SWITCH_OTA_FLASH_DELAY_MS therefore stalls the CPU while the switch waits
+ *          for that response, instead of delaying the request.
+ */
+static void switch_ota_flash_step_schedule(zb_callback_t step)
+{
+    zb_ret_t zb_err_code;
+
+    /* Scheduled as an alarm rather than a callback, so switch_ota_stop can cancel it. */
+    zb_err_code = ZB_SCHEDULE_ALARM(step, 0, ZB_MILLISECONDS_TO_BEACON_INTERVAL(SWITCH_OTA_FLASH_DELAY_MS));
+    ZB_ERROR_CHECK(zb_err_code);
+}
+
+/**@brief Function for writing the page buffer handed to flash.
+ *
+ * @details The page was normally erased by switch_ota_page_erase while its blocks came in. The
+ *          erase of the page now being received follows as the next step.
+ */
+static zb_void_t switch_ota_page_write(zb_uint8_t param)
+{
+    switch_ctx_t * p_ctx    = &m_device_ctx;
+    switch_ota_t * p_ota    = &p_ctx->ota;
+    zb_uint16_t    padded   = ( p_ota->write_len + 3 ) & ~3;
+    ret_code_t     err_code = NRF_SUCCESS;
+
+    UNUSED_PARAMETER(param);
+
+    if (!p_ota->active || !p_ota->write_busy)
+    {
+        return;
+    }
+
+    switch_ota_hash_page( p_ctx, m_ota_page[p_ota->write_buf], p_ota->write_addr - SWITCH_OTA_SLOT_START, p_ota->write_len );
+
+    /* fstorage writes whole words - pad the last page of the image. */
+    memset( &m_ota_page[p_ota->write_buf][p_ota->write_len], 0xFF, padded - p_ota->write_len );
+
+    if (p_ota->write_addr >= p_ota->erased_addr)
+    {
+        /* Not erased ahead - the page a download starts or resumes at. */
+        SWITCH_PROFILE_START( SWITCH_PROFILE_OTA_PAGE_ERASE );
+        err_code = nrf_fstorage_erase(&m_ota_fstorage, p_ota->write_addr, 1, NULL);
+        SWITCH_PROFILE_STOP( SWITCH_PROFILE_OTA_PAGE_ERASE );
+        p_ota->erased_addr = p_ota->write_addr + SWITCH_OTA_PAGE_SIZE;
+    }
+    if (err_code == NRF_SUCCESS)
+    {
+        SWITCH_PROFILE_START( SWITCH_PROFILE_OTA_PAGE_WRITE );
+        err_code = nrf_fstorage_write(&m_ota_fstorage, p_ota->write_addr, m_ota_page[p_ota->write_buf], padded, NULL);
+        SWITCH_PROFILE_STOP( SWITCH_PROFILE_OTA_PAGE_WRITE );
+    }
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_WARNING( "OTA flash operation at 0x%x failed, error %d", p_ota->write_addr, err_code );
+        p_ota->write_error = ZB_TRUE;
+        switch_ota_fstorage_evt_handler(NULL);
+        return;
+    }
+
+    switch_ota_flash_step_schedule(switch_ota_page_erase);
+}
+
+/**@brief Function for handing the full page buffer over to flash and receiving into the other one.
+ *
+ * @details The NVMC backend of fstorage is synchronous: an erase or a write stalls the CPU until
+ *          it completes. The page write and the erase of the next page are therefore run as two
+ *          separate, delayed scheduler steps (see switch_ota_flash_step_schedule), and both fit
+ *          between two polls. The "ota_page_write" and "ota_page_erase" profiling probes show how
+ *          long each stall is.
+ */
+static void switch_ota_page_flush(switch_ota_t * p_ota)
+{
+    p_ota->write_busy = ZB_TRUE;
+    p_ota->write_buf  = p_ota->fill_buf;
+    p_ota->write_len  = p_ota->fill_len;
+    p_ota->write_addr = p_ota->fill_addr;
+
+    p_ota->fill_buf  ^= 1;
+    p_ota->fill_len   = 0;
+    p_ota->fill_addr += SWITCH_OTA_PAGE_SIZE;
+
+    switch_ota_flash_step_schedule(switch_ota_page_write);
+}
+
+/**@brief Function for moving the received data on into the page buffers and flash.
+ *
+ * @return ZB_ZCL_OTA_UPGRADE_STATUS_BUSY while the data has to wait for a page write, otherwise
+ *         the result for the OTA client.
+ */
+static zb_uint8_t switch_ota_progress(switch_ctx_t * p_ctx)
+{
+    switch_ota_t * p_ota = &p_ctx->ota;
+
+    for (;;)
+    {
+        if (p_ota->fill_len == SWITCH_OTA_PAGE_SIZE && !p_ota->write_busy)
+        {
+            switch_ota_page_flush(p_ota);
+        }
+        if (p_ota->pending_len == 0 && p_ota->delta &&
+            !switch_ota_delta_decode(&p_ota->patch, &p_ota->p_pending, &p_ota->pending_len))
+        {
+            return ZB_ZCL_OTA_UPGRADE_STATUS_ERROR;
+        }
+        if (p_ota->pending_len == 0)
+        {
+            break;
+        }
+        if (p_ota->fill_len == SWITCH_OTA_PAGE_SIZE)
+        {
+            /* Both page buffers are in use. */
+            return ZB_ZCL_OTA_UPGRADE_STATUS_BUSY;
+        }
+
+        zb_uint16_t chunk = MIN(p_ota->pending_len, SWITCH_OTA_PAGE_SIZE - p_ota->fill_len);
+
+        ZB_MEMCPY( &m_ota_page[p_ota->fill_buf][p_ota->fill_len], p_ota->p_pending, chunk );
+        p_ota->fill_len    += chunk;
+        p_ota->p_pending   += chunk;
+        p_ota->pending_len -= chunk;
+    }
+
+    if (p_ota->finishing)
+    {
+        if (p_ota->write_busy)
+        {
+            return ZB_ZCL_OTA_UPGRADE_STATUS_BUSY;
+        }
+        if (p_ota->fill_len > 0)
+        {
+            switch_ota_page_flush(p_ota);
+            return ZB_ZCL_OTA_UPGRADE_STATUS_BUSY;
+        }
+        if (!p_ota->write_error)
+        {
+            /* The whole file is in the slot. */
+            zb_uint8_t status = switch_ota_verify(p_ctx);
+
+            if (status == ZB_ZCL_OTA_UPGRADE_STATUS_OK)
+            {
+                p_ota->finished_at = ZB_TIMER_GET();
+            }
+            return status;
+        }
+    }
+
+    return p_ota->write_error ? ZB_ZCL_OTA_UPGRADE_STATUS_ERROR : ZB_ZCL_OTA_UPGRADE_STATUS_OK;
+}
+
+/**@brief Function for recording that the download slot holds the file up to the given offset.
+ *
+ * @details The checkpoint is written to NVRAM every SWITCH_OTA_CHECKPOINT_PAGES pages. Any other
+ *          write of the application dataset in between saves the latest offset as well.
+ */
+static void switch_ota_checkpoint(switch_ctx_t * p_ctx, zb_uint32_t offset)
+{
+    if (p_ctx->ota.delta)
+    {
+        /* A delta image is parsed as it arrives - its download starts over. */
+        return;
+    }
+
+    p_ctx->ota_checkpoint.offset = offset;
+
+    if (offset % (SWITCH_OTA_CHECKPOINT_PAGES * SWITCH_OTA_PAGE_SIZE) == 0)
+    {
+        UNUSED_RETURN_VALUE(zb_nvram_write_dataset(ZB_NVRAM_APP_DATA1));
+    }
+}
+
+/**@brief Function for dropping the checkpoint, once the download completed or the stored part is of no use.
+ */
+static void switch_ota_checkpoint_clear(switch_ctx_t * p_ctx)
+{
+    zb_bool_t persisted = (p_ctx->ota_checkpoint.offset != 0) ? ZB_TRUE : ZB_FALSE;
+
+    ZB_BZERO( &p_ctx->ota_checkpoint, sizeof(p_ctx->ota_checkpoint) );
+    ZB_BZERO( &p_ctx->ota_hash, sizeof(p_ctx->ota_hash) );
+    if (persisted)
+    {
+        UNUSED_RETURN_VALUE(zb_nvram_write_dataset(ZB_NVRAM_APP_DATA1));
+    }
+}
+
+/**@brief Function for checking a checkpoint restored from NVRAM against the download slot.
+ *
+ * @details The header of the OTA file, stored in the first page of the slot, must match the
+ *          image the checkpoint was taken for, and the restored hash state must cover exactly the
+ *          part of the file in the slot. The OTA attributes set to their defaults by
+ *          bulb_clusters_attr_init are then restored, so the client asks for the image again
+ *          from the checkpoint offset.
+ */
+static void switch_ota_checkpoint_restore(switch_ctx_t * p_ctx)
+{
+    const zb_zcl_ota_upgrade_file_header_t * p_header = (const zb_zcl_ota_upgrade_file_header_t *)SWITCH_OTA_SLOT_START;
+    switch_ota_checkpoint_t                * p_ckpt   = &p_ctx->ota_checkpoint;
+    zb_uint64_t                              hashed;
+
+    if (p_ckpt->offset == 0)
+    {
+        return;
+    }
+    hashed = p_ctx->ota_hash.bitlen / 8 + p_ctx->ota_hash.datalen;
+    if (p_ckpt->offset % SWITCH_OTA_PAGE_SIZE != 0 || p_ckpt->offset >= p_ckpt->file_length ||
+        hashed != MIN(p_ckpt->offset, p_ckpt->file_length - SWITCH_OTA_TAG_SHA256_SIZE) ||
+        p_header->file_id != ZB_ZCL_OTA_UPGRADE_FILE_HEADER_FILE_ID ||
+        p_header->file_version != p_ckpt->file_version ||
+        p_header->total_image_size != p_ckpt->file_length)
+    {
+        NRF_LOG_WARNING( "OTA checkpoint at %u does not match the download slot, dropped", p_ckpt->offset );
+        ZB_BZERO( p_ckpt, sizeof(*p_ckpt) );
+        ZB_BZERO( &p_ctx->ota_hash, sizeof(p_ctx->ota_hash) );
+        return;
+    }
+
+    p_ctx->zha_otau_attr.file_offset         = p_ckpt->offset;
+    p_ctx->zha_otau_attr.downloaded_file_ver = p_ckpt->file_version;
+    p_ctx->zha_otau_attr.image_status        = ZB_ZCL_OTA_UPGRADE_IMAGE_STATUS_DOWNLOADING;
+    NRF_LOG_INFO( "OTA download of 0x%08x resumable at %u of %u bytes", p_ckpt->file_version, p_ckpt->offset, p_ckpt->file_length );
+}
+
+/**@brief Callback for the completion of the flash operations of a page.
+ *
+ * @details The NVMC backend completes the operation before nrf_fstorage_erase/write return, so
+ *          this runs in the context of switch_ota_page_write or switch_ota_page_erase. An erase is
+ *          only noted, the page buffer is free once its write completed.
+ */
+static void switch_ota_fstorage_evt_handler(nrf_fstorage_evt_t * p_evt)
+{
+    switch_ctx_t * p_ctx = &m_device_ctx;
+    switch_ota_t * p_ota = &p_ctx->ota;
+    zb_uint8_t     status;
+
+    if (p_evt != NULL)
+    {
+        if (p_evt->result != NRF_SUCCESS)
+        {
+            NRF_LOG_WARNING( "OTA flash operation at 0x%x failed, error %d", p_evt->addr, p_evt->result );
+            p_ota->write_error = ZB_TRUE;
+        }
+        if (p_evt->id != NRF_FSTORAGE_EVT_WRITE_RESULT && p_evt->result == NRF_SUCCESS)
+        {
+            return;
+        }
+    }
+
+    if (!p_ota->active || !p_ota->write_busy)
+    {
+        return;
+    }
+    p_ota->write_busy = ZB_FALSE;
+
+    if (!p_ota->write_error && p_ota->write_len == SWITCH_OTA_PAGE_SIZE)
+    {
+        switch_ota_checkpoint(p_ctx, p_ota->write_addr + SWITCH_OTA_PAGE_SIZE - SWITCH_OTA_SLOT_START);
+    }
+
+    status = switch_ota_progress(p_ctx);
+    if (p_ota->paused_param != 0 && status != ZB_ZCL_OTA_UPGRADE_STATUS_BUSY)
+    {
+        zb_uint8_t param = p_ota->paused_param;
+
+        p_ota->paused_param = 0;
+        zb_zcl_ota_upgrade_resume_client(param, status);
+    }
+}
+
+/**@brief Callback setting the image type the client queries back to the full image.
+ */
+static zb_void_t switch_ota_image_type_restore(zb_uint8_t param)
+{
+    switch_ctx_t * p_ctx = &m_device_ctx;
+
+    UNUSED_PARAMETER(param);
+
+    if (!p_ctx->ota.active)
+    {
+        p_ctx->zha_otau_attr.image_type = SWITCH_OTA_IMAGE_TYPE;
+    }
+}
+
+/**@brief Function for going back to the full image once a delta query or download ended.
+ *
+ * @details The image type is set back from a callback, so the frames the client still sends for
+ *          the delta, like the Upgrade End Request of a failed download, carry its image type.
+ */
+static void switch_ota_full_image_query(switch_ctx_t * p_ctx)
+{
+    zb_ret_t zb_err_code;
+
+    if (p_ctx->zha_otau_attr.image_type != SWITCH_OTA_IMAGE_TYPE)
+    {
+        zb_err_code = ZB_SCHEDULE_CALLBACK( switch_ota_image_type_restore, 0 );
+        ZB_ERROR_CHECK(zb_err_code);
+    }
+}
+
+/**@brief Function for ending the download, successful or not, and leaving fast poll.
+ *
+ * @details A flash step still scheduled is cancelled - a page not yet written is lost, the
+ *          checkpoint only covers pages already in flash. A block held back with BUSY is handed back to the
+ *          client as an error, so the client ends its side of the download and frees the buffer.
+ */
+static void switch_ota_stop(switch_ctx_t * p_ctx)
+{
+    zb_uint8_t paused_param = p_ctx->ota.paused_param;
+
+    UNUSED_RETURN_VALUE(ZB_SCHEDULE_ALARM_CANCEL( switch_ota_page_write, ZB_ALARM_ANY_PARAM ));
+    UNUSED_RETURN_VALUE(ZB_SCHEDULE_ALARM_CANCEL( switch_ota_page_erase, ZB_ALARM_ANY_PARAM ));
+    ZB_BZERO( &p_ctx->ota, sizeof(p_ctx->ota) );
+    switch_poll_interval_update(p_ctx);
+    switch_ota_full_image_query(p_ctx);
+
+    if (paused_param != 0)
+    {
+        zb_zcl_ota_upgrade_resume_client(paused_param, ZB_ZCL_OTA_UPGRADE_STATUS_ERROR);
+    }
+}
+
+/**@brief Function for starting a download announced by the OTA server.
+ */
+static zb_uint8_t switch_ota_start(switch_ctx_t * p_ctx, const zb_zcl_ota_upgrade_value_param_t * p_value)
+{
+    /* An image already waiting in the slot is not downloaded again. */
+    if (p_value->upgrade.start.file_version <= p_ctx->zha_otau_attr.file_version ||
+        p_value->upgrade.start.file_version <= p_ctx->ota_ready_version ||
+        p_value->upgrade.start.file_length > SWITCH_OTA_SLOT_SIZE ||
+        p_value->upgrade.start.file_length < sizeof(zb_zcl_ota_upgrade_file_header_t) + SWITCH_OTA_TAG_SHA256_SIZE ||
+        ( p_value->upgrade.start.image_type == SWITCH_OTA_IMAGE_TYPE_DELTA &&
+          p_value->upgrade.start.file_version == p_ctx->ota_delta_failed_version ))
+    {
+        NRF_LOG_WARNING( "OTA image 0x%08x (%u bytes) rejected",
+                         p_value->upgrade.start.file_version, p_value->upgrade.start.file_length );
+        switch_ota_full_image_query(p_ctx);
+        return ZB_ZCL_OTA_UPGRADE_STATUS_ABORT;
+    }
+    if (p_ctx->low_power)
+    {
+        /* A battery this low may not last through the download and the flash writes. */
+        NRF_LOG_WARNING( "OTA postponed, battery low" );
+        return ZB_ZCL_OTA_UPGRADE_STATUS_ABORT;
+    }
+
+    ZB_BZERO( &p_ctx->ota, sizeof(p_ctx->ota) );
+    p_ctx->ota.active       = ZB_TRUE;
+    p_ctx->ota.file_version = p_value->upgrade.start.file_version;
+    p_ctx->ota.file_length  = p_value->upgrade.start.file_length;
+    p_ctx->ota.image_length = p_value->upgrade.start.file_length;
+    p_ctx->ota.started_at   = ZB_TIMER_GET();
+    /* A delta image builds the OTA file from the running image; its length is in the patch. */
+    p_ctx->ota.delta        = (p_value->upgrade.start.image_type == SWITCH_OTA_IMAGE_TYPE_DELTA) ? ZB_TRUE : ZB_FALSE;
+    if (p_ctx->ota.delta)
+    {
+        switch_ota_delta_init(&p_ctx->ota.patch, (const zb_uint8_t *)SWITCH_OTA_RUNNING_START, SWITCH_OTA_RUNNING_SIZE,
+                              p_ctx->zha_otau_attr.file_version,
+                              sizeof(zb_zcl_ota_upgrade_file_header_t) + SWITCH_OTA_TAG_SHA256_SIZE, SWITCH_OTA_SLOT_SIZE);
+    }
+
+    if (!p_ctx->ota.delta && p_ctx->ota_checkpoint.offset != 0 &&
+        p_ctx->ota_checkpoint.file_version == p_value->upgrade.start.file_version &&
+        p_ctx->ota_checkpoint.file_length == p_value->upgrade.start.file_length)
+    {
+        /* The slot holds the file up to the checkpoint - continue from there. */
+        p_ctx->ota.received              = p_ctx->ota_checkpoint.offset;
+        p_ctx->ota.resumed_from          = p_ctx->ota_checkpoint.offset;
+        p_ctx->zha_otau_attr.file_offset = p_ctx->ota_checkpoint.offset;
+    }
+    else
+    {
+        switch_ota_checkpoint_clear(p_ctx);
+        p_ctx->ota_checkpoint.file_version = p_value->upgrade.start.file_version;
+        p_ctx->ota_checkpoint.file_length  = p_value->upgrade.start.file_length;
+        UNUSED_RETURN_VALUE(sha256_init(&p_ctx->ota_hash));
+    }
+    p_ctx->ota.fill_addr   = SWITCH_OTA_SLOT_START + p_ctx->ota.received;
+    p_ctx->ota.erased_addr = p_ctx->ota.fill_addr;
+    switch_ota_flash_step_schedule(switch_ota_page_erase);
+    switch_poll_interval_update(p_ctx);
+
+    NRF_LOG_INFO( "OTA download of 0x%08x started at %u of %u bytes",
+                  p_value->upgrade.start.file_version, p_ctx->ota.received, p_ctx->ota.file_length );
+    return ZB_ZCL_OTA_UPGRADE_STATUS_OK;
+}
+
+/**@brief Function for handling the OTA client callback.
+ *
+ * @param[in]   p_ctx     Switch the download is for.
+ * @param[in]   param     Reference to the buffer of the device callback, kept when answered BUSY.
+ * @param[in]   p_value   OTA callback parameters; the result is returned in upgrade_status.
+ */
+static void switch_ota_process(switch_ctx_t * p_ctx, zb_uint8_t param, zb_zcl_ota_upgrade_value_param_t * p_value)
+{
+    switch_ota_t * p_ota  = &p_ctx->ota;
+    zb_uint8_t     status = ZB_ZCL_OTA_UPGRADE_STATUS_OK;
+
+    switch (p_value->upgrade_status)
+    {
+        case ZB_ZCL_OTA_UPGRADE_STATUS_START:
+            status = switch_ota_start(p_ctx, p_value);
+            break;
+
+        case ZB_ZCL_OTA_UPGRADE_STATUS_RECEIVE:
+            {
+                zb_uint32_t offset = p_value->upgrade.receive.file_offset;
+                zb_uint32_t length = p_value->upgrade.receive.data_length;
+                zb_uint32_t stored;
+
+                if (!p_ota->active || offset > p_ota->received || offset + length > p_ota->file_length)
+                {
+                    NRF_LOG_WARNING( "OTA block at %u unexpected", offset );
+                    status = ZB_ZCL_OTA_UPGRADE_STATUS_ERROR;
+                    break;
+                }
+
+                /* After a resume the client may ask again for data already in the slot. */
+                stored = p_ota->received - offset;
+                if (stored >= length)
+                {
+                    break;
+                }
+                p_ota->received  += length - stored;
+                p_ota->block_max  = (zb_uint16_t)MAX(p_ota->block_max, length);
+                if (p_ota->delta)
+                {
+                    switch_ota_delta_input(&p_ota->patch, p_value->upgrade.receive.block_data + stored, length - stored);
+                }
+                else
+                {
+                    p_ota->p_pending   = p_value->upgrade.receive.block_data + stored;
+                    p_ota->pending_len = length - stored;
+                }
+                status = switch_ota_progress(p_ctx);
+            }
+            break;
+
+        case ZB_ZCL_OTA_UPGRADE_STATUS_CHECK:
+            if (!p_ota->active || p_ota->received != p_ota->file_length ||
+                ( p_ota->delta && !switch_ota_delta_complete(&p_ota->patch) ))
+            {
+                status = ZB_ZCL_OTA_UPGRADE_STATUS_ERROR;
+                break;
+            }
+            if (p_ota->delta)
+            {
+                p_ota->image_length = p_ota->patch.image_length;
+            }
+            p_ota->finishing = ZB_TRUE;
+            status = switch_ota_progress(p_ctx);
+            break;
+
+        case ZB_ZCL_OTA_UPGRADE_STATUS_APPLY:
+            break;
+
+        case ZB_ZCL_OTA_UPGRADE_STATUS_FINISH:
+            {
+                zb_uint32_t elapsed_ms = ZB_TIME_BEACON_INTERVAL_TO_MSEC( ZB_TIME_SUBTRACT( p_ota->finished_at, p_ota->started_at ) );
+                zb_uint32_t bytes      = p_ota->file_length - p_ota->resumed_from;
+
+                /* Bytes, download time, throughput and the block size the server chose (at most
+                 * SWITCH_OTA_BLOCK_SIZE), for comparing block sizes and poll intervals. */
+                NRF_LOG_INFO( "OTA,%u,%u,%u,%u", bytes, elapsed_ms,
+                              elapsed_ms ? (zb_uint32_t)( (zb_uint64_t)bytes * 1000 / elapsed_ms ) : 0,
+                              p_ota->block_max );
+                if (p_ota->delta)
+                {
+                    NRF_LOG_INFO( "OTA delta image of %u bytes built %u bytes", p_ota->file_length, p_ota->image_length );
+                }
+
+                /* Activation is up to the bootloader. Until it takes the image over, the server
+                 * is not asked for the same version again. */
+                p_ctx->ota_ready_version                 = p_ota->file_version;
+                p_ctx->zha_otau_attr.downloaded_file_ver = p_ota->file_version;
+                p_ctx->zha_otau_attr.image_status        = ZB_ZCL_OTA_UPGRADE_IMAGE_STATUS_DOWNLOADED;
+                NRF_LOG_INFO( "OTA image 0x%08x ready in the download slot", p_ota->file_version );
+                switch_ota_checkpoint_clear(p_ctx);
+                switch_ota_stop(p_ctx);
+            }
+            break;
+
+        default:
+            /* Abort, server not found and the like. The checkpoint is kept for the next attempt. */
+            NRF_LOG_INFO( "OTA ended with status %d", p_value->upgrade_status );
+            switch_ota_stop(p_ctx);
+            break;
+    }
+
+    if (status == ZB_ZCL_OTA_UPGRADE_STATUS_BUSY)
+    {
+        p_ota->paused_param = param;
+    }
+    else if (status != ZB_ZCL_OTA_UPGRADE_STATUS_OK && p_ota->active)
+    {
+        if (p_ota->delta)
+        {
+            /* The server is not asked for this delta again, only for the full image. */
+            p_ctx->ota_delta_failed_version = p_ota->file_version;
+        }
+        switch_ota_checkpoint_clear(p_ctx);
+        switch_ota_stop(p_ctx);
+    }
+    p_value->upgrade_status = status;
+}
+
+/**@brief Function for choosing the image type the client queries on an Image Notify of the OTA server.
+ *
+ * @details Called before the OTA client processes the command. A delta image advertised for the
+ *          switch is queried instead of the full image, unless a delta of that version already
+ *          failed to apply. The client then sends the Query Next Image Request with the delta
+ *          image type.
+ *
+ * @param[in]   p_ctx     Switch the command is for.
+ * @param[in]   p_data    Payload of the Image Notify command.
+ * @param[in]   len       Length of the payload.
+ */
+static void switch_ota_image_notify(switch_ctx_t * p_ctx, const zb_uint8_t * p_data, zb_uint16_t len)
+{
+    zb_uint16_t manufacturer;
+    zb_uint16_t image_type;
+    zb_uint32_t file_version = 0;
+
+    if (p_ctx->ota.active || len < 6 || p_data[0] < ZB_ZCL_OTA_UPGRADE_IMAGE_NOTIFY_PAYLOAD_JITTER_CODE_IMAGE)
+    {
+        return;
+    }
+    ZB_LETOH16( &manufacturer, &p_data[2] );
+    ZB_LETOH16( &image_type, &p_data[4] );
+    if (p_data[0] >= ZB_ZCL_OTA_UPGRADE_IMAGE_NOTIFY_PAYLOAD_JITTER_CODE_IMAGE_VERSION && len >= 10)
+    {
+        ZB_LETOH32( &file_version, &p_data[6] );
+    }
+    if (manufacturer != p_ctx->zha_otau_attr.manufacturer || image_type != SWITCH_OTA_IMAGE_TYPE_DELTA)
+    {
+        return;
+    }
+    if (p_ctx->ota_delta_failed_version != 0 &&
+        (file_version == 0 || file_version == p_ctx->ota_delta_failed_version))
+    {
+        NRF_LOG_INFO( "Delta OTA image 0x%08x advertised, the full image is queried", file_version );
+        return;
+    }
+
+    p_ctx->zha_otau_attr.image_type = SWITCH_OTA_IMAGE_TYPE_DELTA;
 }
-
-
+#endif
 
 /**@brief Callback function for handling ZCL commands.
  *
@@ -359,8 +1591,8 @@ static void log_init(void)
  */
 static zb_void_t zcl_device_cb(zb_uint8_t param)
 {
-    zb_uint8_t                       cluster_id;
-    zb_uint8_t                       attr_id;
+    zb_uint16_t                      cluster_id;
+    zb_uint16_t                      attr_id;
     uint8_t                          endpoint;           
     zb_buf_t                       * p_buffer = ZB_BUF_FROM_REF(param);
     zb_buf_t                       * p_buf_report;
@@ -387,6 +1619,7 @@ static zb_void_t zcl_device_cb(zb_uint8_t param)
             endpoint   = p_device_cb_param->endpoint;
 
             NRF_LOG_INFO( "Request to write ep/cluster/attr %d/0x%04x/0x%04x", endpoint, cluster_id, attr_id );
+            switch_persistent_attr_written( &m_device_ctx, endpoint, cluster_id, attr_id );
             
 
             // lets set up reporting here
@@ -394,6 +1627,12 @@ static zb_void_t zcl_device_cb(zb_uint8_t param)
 
             break;
 
+#if SWITCH_ZHA_EP_ENABLED
+        case ZB_ZCL_OTA_UPGRADE_VALUE_CB_ID:
+            switch_ota_process( &m_device_ctx, param, &p_device_cb_param->cb_param.ota_value_param );
+            break;
+#endif
+
         default:
             p_device_cb_param->status = RET_ERROR;
             NRF_LOG_INFO( "Unhandled ZCL CB %d", p_device_cb_param->device_cb_id );
@@ -471,14 +1710,40 @@ static zb_void_t light_switch_leave_and_join(zb_uint8_t param)
 }
 
 
+zb_void_t buttonHoldCallback( zb_uint8_t buttonId );
+
+/**@brief Function for ending the button gesture once it is released and all its frames are confirmed.
+ */
+static void light_switch_button_try_complete( switch_ctx_t * p_ctx ){
+    if( p_ctx->button.mayClear && p_ctx->button.framesPending == 0 ) {
+        p_ctx->button.in_progress = ZB_FALSE;
+        NRF_LOG_INFO( "Button event complete" );
+    }
+}
+
+/**@brief Function for abandoning the button gesture in progress, e.g. when leaving the network.
+ *
+ * @details The pending frame count is dropped as well - frames lost with the network would never
+ *          be confirmed. A confirmation still arriving for an earlier frame is ignored by
+ *          @ref switchButtonEventCb.
+ */
+static void light_switch_button_reset( switch_ctx_t * p_ctx ){
+    UNUSED_RETURN_VALUE( ZB_SCHEDULE_ALARM_CANCEL( buttonHoldCallback, ZB_ALARM_ANY_PARAM ) );
+    p_ctx->button.in_progress = ZB_FALSE;
+    p_ctx->button.mayClear = ZB_FALSE;
+    p_ctx->button.longHold = ZB_FALSE;
+    p_ctx->button.framesPending = 0;
+}
+
 void switchButtonEventCb( zb_uint8_t param ){
+    switch_ctx_t * p_ctx = &m_device_ctx;
+
     NRF_LOG_INFO( "Button event command callback called" );
     ZB_FREE_BUF_BY_REF( param );
-    m_device_ctx.button.bufferInUse = ZB_FALSE;
-    if( m_device_ctx.button.mayClear ) {
-        m_device_ctx.button.in_progress = ZB_FALSE;
-        NRF_LOG_INFO( "Button event complete" );
+    if( p_ctx->button.framesPending > 0 ){
+        p_ctx->button.framesPending--;
     }
+    light_switch_button_try_complete( p_ctx );
 }
 
 
@@ -502,13 +1767,86 @@ void switchButtonEventCb( zb_uint8_t param ){
 #define DECODE_BUTTON_INFO_TRANSITION_TYPE( buttonData ) (zb_uint8_t) ( ( buttonData & 0x0F00 ) >> 8 )
 #define DECODE_BUTTON_INFO_COUNTER( buttonData ) (zb_uint8_t) ( buttonData & 0x00FF )
 
-static zb_uint64_t generateButtonEventData( zb_uint8_t buttonId, zb_uint8_t buttonState, zb_uint8_t eventTime ){
-    zb_uint64_t retVal;
+#if SWITCH_ZHA_EP_ENABLED && SWITCH_PERSONALITY_GREEN_POWER
+/**@brief Function for sending the Green Power command of a button press to the bridge.
+ *
+ * @details The switch forwards the GPD command the Tap would send as a GP Notification, as a
+ *          Green Power proxy would (see switch_gp.h). The GPD SrcID is the low half of the IEEE
+ *          address.
+ *
+ * @param[in]   param        Non-zero reference to ZigBee stack buffer used to construct the command.
+ * @param[in]   buttonInfo   Button info encoded with @ref ENCODE_BUTTON_INFO.
+ */
+static zb_void_t sendGpButtonNotification( zb_uint8_t param, zb_uint16_t buttonInfo ){
+    switch_ctx_t * p_ctx = &m_device_ctx;
+    zb_buf_t     * p_buf = ZB_BUF_FROM_REF( param );
+    zb_uint16_t    addr  = PHILIPS_BRIDGE_SHORT_ADDR;
+    zb_ieee_addr_t ieee_addr;
+    zb_uint32_t    src_id;
+    zb_uint8_t   * cmd_ptr;
+
+    zb_get_long_address( ieee_addr );
+    ZB_LETOH32( &src_id, ieee_addr );
+
+    cmd_ptr = (zb_uint8_t*)zb_zcl_start_command_header( p_buf,
+                                 ZB_ZCL_CONSTRUCT_FRAME_CONTROL( ZB_ZCL_FRAME_TYPE_CLUSTER_SPECIFIC,
+                                                                 ZB_ZCL_NOT_MANUFACTURER_SPECIFIC,
+                                                                 ZB_ZCL_FRAME_DIRECTION_TO_SRV,
+                                                                 ZB_ZCL_DISABLE_DEFAULT_RESPONSE ),
+                                 0,
+                                 SWITCH_GP_CMD_NOTIFICATION,
+                                 NULL );
+    cmd_ptr += switch_gp_notification_put( cmd_ptr, src_id, p_ctx->gp_frame_counter++,
+                                           SWITCH_PERSONALITY_GPD_CMD( DECODE_BUTTON_INFO_ID( buttonInfo ) ) );
+    ZB_ZCL_FINISH_PACKET( p_buf, cmd_ptr )
+    ZB_ZCL_SEND_COMMAND_SHORT(
+      p_buf, addr,
+      (ZB_APS_ADDR_MODE_16_ENDP_PRESENT), (SWITCH_GP_ENDPOINT),
+      (SWITCH_GP_ENDPOINT), (SWITCH_GP_PROFILE_ID),
+      SWITCH_GP_CLUSTER_ID, ( zb_callback_t ) switchButtonEventCb );
+    p_ctx->charge.tx_frames++;
+}
 
-    retVal = ( ( (zb_uint64_t) 0x30 ) << 24 ) | ( ( (zb_uint64_t) 0x21 ) << 40 );
-    retVal |= ( ( (zb_uint64_t) buttonId ) << 0 ) | ( ( (zb_uint64_t) buttonState ) << 32 ) | ( ( (zb_uint64_t) eventTime ) << 48 );
-    
-    return retVal;
+/**@brief Function for announcing the switch to the bridge as a Green Power on/off switch.
+ *
+ * @details Sent once the switch joined, as the GP Commissioning Notification a proxy forwards
+ *          when a GPD is commissioned. The bridge takes the switch in while it searches for new
+ *          devices.
+ *
+ * @param[in]   param   Non-zero reference to ZigBee stack buffer used to construct the command.
+ */
+static zb_void_t switch_gp_commission( zb_uint8_t param ){
+    switch_ctx_t * p_ctx = &m_device_ctx;
+    zb_buf_t     * p_buf = ZB_BUF_FROM_REF( param );
+    zb_uint16_t    addr  = PHILIPS_BRIDGE_SHORT_ADDR;
+    zb_ieee_addr_t ieee_addr;
+    zb_uint32_t    src_id;
+    zb_uint8_t   * cmd_ptr;
+
+    zb_get_long_address( ieee_addr );
+    ZB_LETOH32( &src_id, ieee_addr );
+
+    cmd_ptr = (zb_uint8_t*)zb_zcl_start_command_header( p_buf,
+                                 ZB_ZCL_CONSTRUCT_FRAME_CONTROL( ZB_ZCL_FRAME_TYPE_CLUSTER_SPECIFIC,
+                                                                 ZB_ZCL_NOT_MANUFACTURER_SPECIFIC,
+                                                                 ZB_ZCL_FRAME_DIRECTION_TO_SRV,
+                                                                 ZB_ZCL_DISABLE_DEFAULT_RESPONSE ),
+                                 0,
+                                 SWITCH_GP_CMD_COMMISSIONING_NOTIFICATION,
+                                 NULL );
+    cmd_ptr += switch_gp_commissioning_put( cmd_ptr, src_id, p_ctx->gp_frame_counter++,
+                                            SWITCH_GPD_DEVICE_ID_ON_OFF_SWITCH );
+    ZB_ZCL_FINISH_PACKET( p_buf, cmd_ptr )
+    ZB_ZCL_SEND_COMMAND_SHORT(
+      p_buf, addr,
+      (ZB_APS_ADDR_MODE_16_ENDP_PRESENT), (SWITCH_GP_ENDPOINT),
+      (SWITCH_GP_ENDPOINT), (SWITCH_GP_PROFILE_ID),
+      SWITCH_GP_CLUSTER_ID, NULL );
+    p_ctx->charge.tx_frames++;
+}
+#elif SWITCH_ZHA_EP_ENABLED
+static zb_uint64_t generateButtonEventData( zb_uint8_t buttonId, zb_uint8_t buttonState, zb_uint8_t eventTime ){
+    return SWITCH_PERSONALITY_EVENT_DATA( buttonId, buttonState, eventTime );
 }
 
 
@@ -518,18 +1856,24 @@ static zb_uint64_t generateButtonEventData( zb_uint8_t buttonId, zb_uint8_t butt
  * @param[in]   on_off   Requested state of the light bulb.
  */
 static zb_void_t sendHueButtonUpdateCommand( zb_uint8_t param, zb_uint16_t buttonInfo ){
+    switch_ctx_t * p_ctx = &m_device_ctx;
+
     NRF_LOG_INFO( "Send button data" );
     zb_buf_t * buttonEventBuffer;
     zb_uint8_t frameCtrl;
     zb_uint8_t * cmd_ptr;
 
     // Decode the button info
+    SWITCH_PROFILE_START( SWITCH_PROFILE_BUTTON_INFO_DECODE );
     zb_uint8_t buttonId = DECODE_BUTTON_INFO_ID( buttonInfo );
     zb_uint8_t buttonTransitionState = DECODE_BUTTON_INFO_TRANSITION_TYPE( buttonInfo );
     zb_uint8_t buttonTime = DECODE_BUTTON_INFO_COUNTER( buttonInfo );
+    SWITCH_PROFILE_STOP( SWITCH_PROFILE_BUTTON_INFO_DECODE );
 
     // Get command data from button info - TODO maybe reduce the number of functions n stuff here to reduce param passing
-    zb_uint64_t commandData = generateButtonEventData( buttonId + 1, buttonTransitionState, buttonTime );
+    SWITCH_PROFILE_START( SWITCH_PROFILE_EVENT_DATA );
+    zb_uint64_t commandData = generateButtonEventData( buttonId, buttonTransitionState, buttonTime );
+    SWITCH_PROFILE_STOP( SWITCH_PROFILE_EVENT_DATA );
 
     NRF_LOG_INFO( "Get buffer" );
     // Get a free buffer
@@ -537,6 +1881,7 @@ static zb_void_t sendHueButtonUpdateCommand( zb_uint8_t param, zb_uint16_t butto
 
     NRF_LOG_INFO( "Start packet" );
 
+    SWITCH_PROFILE_START( SWITCH_PROFILE_FRAME_BUILD );
     frameCtrl = ZB_ZCL_CONSTRUCT_FRAME_CONTROL( 
         ZB_ZCL_FRAME_TYPE_CLUSTER_SPECIFIC,
         ZB_ZCL_MANUFACTURER_SPECIFIC,
@@ -556,49 +1901,235 @@ static zb_void_t sendHueButtonUpdateCommand( zb_uint8_t param, zb_uint16_t butto
 
     NRF_LOG_INFO( "Send packet" );
 
-    zb_uint16_t addr = 0x0001;
+    zb_uint16_t addr = PHILIPS_BRIDGE_SHORT_ADDR;
     ZB_ZCL_FINISH_PACKET( buttonEventBuffer, cmd_ptr )
+    SWITCH_PROFILE_STOP( SWITCH_PROFILE_FRAME_BUILD );
     ZB_ZCL_SEND_COMMAND_SHORT(
       buttonEventBuffer, addr, 
       (ZB_APS_ADDR_MODE_16_ENDP_PRESENT), (PHILIPS_BRIDGE_ZHA_ENDPOINT), 
       (LIGHT_SWITCH_ZHA_ENDPOINT), (ZB_AF_HA_PROFILE_ID), 
       ZB_ZCL_CLUSTER_ID_TUNNEL, ( zb_callback_t ) switchButtonEventCb );
+    p_ctx->charge.tx_frames++;
 
 
     NRF_LOG_INFO( "Finished sending command" );
 
 }
+#else
+/**@brief Function for sending a button event as a ZLL On/Off or Level Control command.
+ *
+ * @details Without the ZHA endpoint there is no bridge to interpret the Hue button events, so
+ *          the switch controls the lights bound to its ZLL endpoint directly: ON and OFF switch
+ *          on press, UP and DOWN step the level on press and on every hold repeat. Events without
+ *          a command hand the buffer straight back to @ref switchButtonEventCb, so the gesture
+ *          completes the same way as when a frame was sent.
+ *
+ * @param[in]   param        Non-zero reference to ZigBee stack buffer used to construct the command.
+ * @param[in]   buttonInfo   Button info encoded with @ref ENCODE_BUTTON_INFO.
+ */
+static zb_void_t sendZllButtonCommand( zb_uint8_t param, zb_uint16_t buttonInfo ){
+    switch_ctx_t * p_ctx              = &m_device_ctx;
+    zb_buf_t  * p_buf                 = ZB_BUF_FROM_REF( param );
+    zb_uint16_t addr                  = 0; /* Unused - sent to the bound lights */
+    zb_uint8_t  buttonId              = DECODE_BUTTON_INFO_ID( buttonInfo );
+    zb_uint8_t  buttonTransitionState = DECODE_BUTTON_INFO_TRANSITION_TYPE( buttonInfo );
+    zb_bool_t   press                 = ( buttonTransitionState == 0x00 ) ? ZB_TRUE : ZB_FALSE;
+    zb_bool_t   hold                  = ( buttonTransitionState == 0x01 ) ? ZB_TRUE : ZB_FALSE;
+
+    if( ( buttonId == 0 || buttonId == 1 ) && press ){
+        ZB_ZCL_ON_OFF_SEND_REQ( p_buf, addr,
+                                ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT, 0,
+                                LIGHT_SWITCH_ZLL_ENDPOINT, ZB_AF_HA_PROFILE_ID,
+                                ZB_ZCL_DISABLE_DEFAULT_RESPONSE,
+                                ( buttonId == 0 ) ? ZB_ZCL_CMD_ON_OFF_ON_ID : ZB_ZCL_CMD_ON_OFF_OFF_ID,
+                                ( zb_callback_t ) switchButtonEventCb );
+    }else if( ( buttonId == 2 || buttonId == 3 ) && ( press || hold ) ){
+        ZB_ZCL_LEVEL_CONTROL_SEND_STEP_WITH_ON_OFF_REQ( p_buf, addr,
+                                ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT, 0,
+                                LIGHT_SWITCH_ZLL_ENDPOINT, ZB_AF_HA_PROFILE_ID,
+                                ZB_ZCL_DISABLE_DEFAULT_RESPONSE,
+                                ( zb_callback_t ) switchButtonEventCb,
+                                ( buttonId == 2 ) ? ZB_ZCL_LEVEL_CONTROL_STEP_MODE_UP : ZB_ZCL_LEVEL_CONTROL_STEP_MODE_DOWN,
+                                LIGHT_SWITCH_DIMM_STEP,
+                                LIGHT_SWITCH_DIMM_TRANSACTION_TIME );
+    }else{
+        switchButtonEventCb( param );
+        return;
+    }
+    p_ctx->charge.tx_frames++;
+}
+#endif
+
+
+/**@brief Function for queueing a button event frame to the bridge, or to the bound lights in the ZLL-only profile.
+ *
+ * @param[in]   p_ctx           Switch the frame is sent for.
+ * @param[in]   buttonInfoEnc   Button info encoded with @ref ENCODE_BUTTON_INFO.
+ *
+ * @return ZB_TRUE if the frame was queued and @ref switchButtonEventCb will be called for it.
+ */
+static zb_bool_t light_switch_button_send( switch_ctx_t * p_ctx, zb_uint16_t buttonInfoEnc ){
+#if SWITCH_ZHA_EP_ENABLED && SWITCH_PERSONALITY_GREEN_POWER
+    zb_ret_t zb_err_code = ZB_GET_OUT_BUF_DELAYED2( sendGpButtonNotification, buttonInfoEnc );
+#elif SWITCH_ZHA_EP_ENABLED
+    zb_ret_t zb_err_code = ZB_GET_OUT_BUF_DELAYED2( sendHueButtonUpdateCommand, buttonInfoEnc );
+#else
+    zb_ret_t zb_err_code = ZB_GET_OUT_BUF_DELAYED2( sendZllButtonCommand, buttonInfoEnc );
+#endif
+    if( zb_err_code != RET_OK ){
+        NRF_LOG_WARNING( "Could not queue button event, status %d", zb_err_code );
+        return ZB_FALSE;
+    }
 
+    p_ctx->button.framesPending++;
+    ASSERT( p_ctx->button.framesPending <= LIGHT_SWITCH_MAX_PENDING_FRAMES );
+    return ZB_TRUE;
+}
 
 zb_void_t buttonHoldCallback( zb_uint8_t buttonId ){
+    switch_ctx_t * p_ctx = &m_device_ctx;
+
     NRF_LOG_INFO( "Button-hold interval callback" );
     // Send command and schedule another alarm if we're not meant to be finishing up
-    if( !m_device_ctx.button.mayClear && m_device_ctx.button.in_progress ){
+    if( !p_ctx->button.mayClear && p_ctx->button.in_progress ){
         zb_ret_t zb_err_code;
 
-        zb_time_t eventTimeBeaconInterval = ZB_TIME_SUBTRACT( ZB_TIMER_GET(), m_device_ctx.button.timestamp );
-        zb_uint16_t eventTimeMs = ZB_TIME_BEACON_INTERVAL_TO_MSEC( eventTimeBeaconInterval );
-        zb_uint8_t buttonTime = (zb_uint8_t) ( eventTimeMs / 100 );
+        zb_time_t eventTimeBeaconInterval = ZB_TIME_SUBTRACT( ZB_TIMER_GET(), p_ctx->button.timestamp );
+        zb_uint32_t eventTimeMs = ZB_TIME_BEACON_INTERVAL_TO_MSEC( eventTimeBeaconInterval );
+        zb_uint8_t buttonTime = (zb_uint8_t) MIN( eventTimeMs / 100, 0xFF );
         zb_uint8_t buttonTransitionState = 0x01;
-        // TODO - ensure we don't try grab too many buffers here
+
+        p_ctx->button.longHold = ZB_TRUE;
+
+        if( eventTimeMs >= LIGHT_SWITCH_BUTTON_MAX_HOLD_MS ){
+            // Release was never seen (or the button is stuck) - finish the gesture as a long release
+            NRF_LOG_WARNING( "Button hold limit reached, finishing gesture" );
+            p_ctx->button.mayClear = ZB_TRUE;
+            UNUSED_RETURN_VALUE( light_switch_button_send( p_ctx, ENCODE_BUTTON_INFO( buttonId, 0x03, buttonTime ) ) );
+            light_switch_button_try_complete( p_ctx );
+            return;
+        }
 
         // Encode the button info for the 16-bit callback parameter
         zb_uint16_t buttonInfoEnc = ENCODE_BUTTON_INFO( buttonId, buttonTransitionState, buttonTime );
 
-        if( m_device_ctx.button.bufferInUse ){
+        // Hold updates are best-effort - skip one rather than queue behind an unconfirmed frame
+        if( p_ctx->button.framesPending > 0 ){
             NRF_LOG_INFO( "Could not send button-hold update as buffer is in use" );
         }else{
-            zb_err_code = ZB_GET_OUT_BUF_DELAYED2( sendHueButtonUpdateCommand, buttonInfoEnc );
-            ZB_ERROR_CHECK(zb_err_code);
+            UNUSED_RETURN_VALUE( light_switch_button_send( p_ctx, buttonInfoEnc ) );
         }
 
-        zb_err_code = ZB_SCHEDULE_ALARM( buttonHoldCallback, buttonId, ZB_MILLISECONDS_TO_BEACON_INTERVAL( 800 ) );
+        zb_err_code = ZB_SCHEDULE_ALARM( buttonHoldCallback, buttonId,
+                                         p_ctx->low_power ? LIGHT_SWITCH_BUTTON_HOLD_INTERVAL_LOW_POWER
+                                                          : LIGHT_SWITCH_BUTTON_HOLD_INTERVAL );
+        ZB_ERROR_CHECK( zb_err_code );
+    }
+}
+
+
+/**@brief Function for running the button gesture state machine on a press or release.
+ *
+ * @param[in]   p_ctx         Switch the button belongs to.
+ * @param[in]   buttonId      Button index (0-3).
+ * @param[in]   buttonPress   1 for a press, 0 for a release.
+ */
+static void light_switch_button_event( switch_ctx_t * p_ctx, zb_uint8_t buttonId, zb_uint8_t buttonPress )
+{
+#if SWITCH_PERSONALITY_HOLD_EVENTS
+    zb_ret_t zb_err_code;
+#endif
+
+    if( !p_ctx->nwk_joined ){
+        NRF_LOG_INFO( "Device not connected so not sending command" );
+        return;
+    }
+
+    ASSERT( p_ctx->button.framesPending <= LIGHT_SWITCH_MAX_PENDING_FRAMES );
+
+    zb_uint8_t buttonTransitionState;
+    zb_uint8_t buttonTime;
+    if( !p_ctx->button.in_progress && buttonPress == 1 ){
+        p_ctx->button.in_progress = ZB_TRUE;
+        p_ctx->button.mayClear = ZB_FALSE;
+        p_ctx->button.progressButtonId = buttonId;
+        p_ctx->button.timestamp = ZB_TIMER_GET();
+        p_ctx->button.longHold = ZB_FALSE;
+        buttonTransitionState = 0x00;
+        buttonTime = 0x00;
+#if SWITCH_PERSONALITY_HOLD_EVENTS
+        // Start blip-blip timer (hold interval)
+        SWITCH_PROFILE_START( SWITCH_PROFILE_ALARM_SCHEDULE );
+        zb_err_code = ZB_SCHEDULE_ALARM( buttonHoldCallback, buttonId,
+                                         p_ctx->low_power ? LIGHT_SWITCH_BUTTON_HOLD_INTERVAL_LOW_POWER
+                                                          : LIGHT_SWITCH_BUTTON_HOLD_INTERVAL );
+        SWITCH_PROFILE_STOP( SWITCH_PROFILE_ALARM_SCHEDULE );
         ZB_ERROR_CHECK( zb_err_code );
+#endif
+        
+    }
+    else if( p_ctx->button.in_progress && !p_ctx->button.mayClear &&
+             buttonPress == 0 && p_ctx->button.progressButtonId == buttonId ){
+        p_ctx->button.mayClear = ZB_TRUE;
+#if SWITCH_PERSONALITY_HOLD_EVENTS
+        // Stop blip-blip timer
+        SWITCH_PROFILE_START( SWITCH_PROFILE_ALARM_CANCEL );
+        zb_err_code = ZB_SCHEDULE_ALARM_CANCEL( buttonHoldCallback, buttonId );
+        SWITCH_PROFILE_STOP( SWITCH_PROFILE_ALARM_CANCEL );
+        ZB_ERROR_CHECK(zb_err_code);
+
+        buttonTransitionState = p_ctx->button.longHold ? 0x03 : 0x02;
+
+        zb_time_t eventTimeBeaconInterval = ZB_TIME_SUBTRACT( ZB_TIMER_GET(), p_ctx->button.timestamp );
+        zb_uint32_t eventTimeMs = ZB_TIME_BEACON_INTERVAL_TO_MSEC( eventTimeBeaconInterval );
+        buttonTime = p_ctx->button.longHold ? (zb_uint8_t) MIN( eventTimeMs / 100, 0xFF ) : 0x01; 
+#else
+        // The personality reports the press only - the gesture ends once its frame is confirmed
+        light_switch_button_try_complete( p_ctx );
+        return;
+#endif
+        
+    }
+    else if( !p_ctx->button.in_progress && buttonPress == 0 ){
+        // Button released when no command-event chain was in progress
+        return;
+    } else{
+        return;
+    }
+
+    // Encode the button info for the 16-bit callback parameter
+    SWITCH_PROFILE_START( SWITCH_PROFILE_BUTTON_INFO_ENCODE );
+    zb_uint16_t buttonInfoEnc = ENCODE_BUTTON_INFO( buttonId, buttonTransitionState, buttonTime );
+    SWITCH_PROFILE_STOP( SWITCH_PROFILE_BUTTON_INFO_ENCODE );
+
+    if( !light_switch_button_send( p_ctx, buttonInfoEnc ) ){
+        // Nothing will confirm this frame - don't leave a released gesture stuck in progress
+        light_switch_button_try_complete( p_ctx );
     }
+
 }
 
+#define LIGHT_SWITCH_BUTTON_EVENT_PARAM( buttonId, buttonPress )   (zb_uint8_t) ( ( (buttonId) << 1 ) | (buttonPress) )
+
+/**@brief Handler running a button event from the main loop, see @ref buttons_handler.
+ *
+ * @param[in]   p_event_data   Button index and press, built with LIGHT_SWITCH_BUTTON_EVENT_PARAM.
+ * @param[in]   event_size     Not used.
+ */
+static void light_switch_button_event_handler( void * p_event_data, uint16_t event_size )
+{
+    zb_uint8_t param = *(zb_uint8_t *)p_event_data;
+
+    UNUSED_PARAMETER(event_size);
+    light_switch_button_event( &m_device_ctx, param >> 1, param & 0x01 );
+}
 
 /**@brief Callback for button events.
+ *
+ * @details The BSP calls this from interrupt context, where the ZBOSS scheduler API must not be
+ *          used. The event is queued in the app scheduler instead, and run from the main loop, so
+ *          the gesture state, and the pending frame count shared with the send confirmations, are
+ *          only touched from there.
  *
  * @param[in]   evt      Incoming event from the BSP subsystem.
  */
@@ -609,17 +2140,11 @@ static void buttons_handler(bsp_event_t evt)
     zb_uint8_t buttonId;
     zb_uint8_t buttonPress;
     zb_uint64_t commandData;
-    zb_ret_t zb_err_code;
 
     UNUSED_VARIABLE( button );
     UNUSED_VARIABLE( buttonId );
     UNUSED_VARIABLE( commandData );
 
-    if( !m_device_ctx.nwk_joined ){
-        NRF_LOG_INFO( "Device not connected so not sending command" );
-        return;
-    }
-
     switch(evt)
     {
         case BSP_EVENT_KEY_0:
@@ -635,6 +2160,8 @@ static void buttons_handler(bsp_event_t evt)
             NRF_LOG_INFO( "ON button released" );
             break;
 
+#if SWITCH_PERSONALITY_BUTTON_COUNT > 1
+
         case BSP_EVENT_KEY_2:
             button = LIGHT_SWITCH_BUTTON_OFF;
             buttonId = 1;
@@ -673,156 +2200,758 @@ static void buttons_handler(bsp_event_t evt)
             buttonPress = 0;
             NRF_LOG_INFO( "LVL DOWN button released" );
             break;
+#endif
 
         default:
             NRF_LOG_INFO("Unhandled BSP Event received: %d", evt);
             return;
     }
-    zb_uint8_t buttonTransitionState;
-    zb_uint8_t buttonTime;
-    if( !m_device_ctx.button.in_progress && buttonPress == 1 ){
-        m_device_ctx.button.in_progress = ZB_TRUE;
-        m_device_ctx.button.progressButtonId = buttonId;
-        m_device_ctx.button.timestamp = ZB_TIMER_GET();
-        m_device_ctx.button.longHold = ZB_FALSE;
-        buttonTransitionState = 0x00;
-        buttonTime = 0x00;
-        // Start blip-blip timer (800ms interval)
-        zb_err_code = ZB_SCHEDULE_ALARM( buttonHoldCallback, button, ZB_MILLISECONDS_TO_BEACON_INTERVAL( 800 ) );
-        ZB_ERROR_CHECK( zb_err_code );
-        
+
+    zb_uint8_t event = LIGHT_SWITCH_BUTTON_EVENT_PARAM( buttonId, buttonPress );
+    ret_code_t err_code = app_sched_event_put( &event, sizeof(event), light_switch_button_event_handler );
+    if( err_code != NRF_SUCCESS ){
+        NRF_LOG_WARNING( "Could not queue button event, error %d", err_code );
     }
-    else if( m_device_ctx.button.in_progress && buttonPress == 0 && m_device_ctx.button.progressButtonId == buttonId ){
-        m_device_ctx.button.mayClear = ZB_TRUE;
-        // Stop blip-blip timer
-        zb_err_code = ZB_SCHEDULE_ALARM_CANCEL( buttonHoldCallback, button );
-        ZB_ERROR_CHECK(zb_err_code);
+}
+
+#if SWITCH_PROFILING_ENABLED
+/**@brief Callback for button events, measuring the time spent in @ref buttons_handler.
+ */
+static void buttons_handler_profiled(bsp_event_t evt)
+{
+    SWITCH_PROFILE_START( SWITCH_PROFILE_BUTTONS_HANDLER );
+    buttons_handler(evt);
+    SWITCH_PROFILE_STOP( SWITCH_PROFILE_BUTTONS_HANDLER );
+}
+#endif
+
+/**@brief Function for initializing LEDs and buttons.
+ */
+static zb_void_t leds_buttons_init(void)
+{
+    ret_code_t error_code;
+
+    /* Initialize LEDs and buttons - use BSP to control them. */
+#if SWITCH_PROFILING_ENABLED
+    error_code = bsp_init(BSP_INIT_LEDS | BSP_INIT_BUTTONS, buttons_handler_profiled);
+#else
+    error_code = bsp_init(BSP_INIT_LEDS | BSP_INIT_BUTTONS, buttons_handler);
+#endif
+    APP_ERROR_CHECK(error_code);
+    /* By default the bsp_init attaches BSP_KEY_EVENTS_{0-4} to the PUSH events of the corresponding buttons. */
+    bsp_event_to_button_action_assign( LIGHT_SWITCH_BUTTON_ON, BSP_BUTTON_ACTION_PUSH, BSP_EVENT_KEY_0 );
+    bsp_event_to_button_action_assign( LIGHT_SWITCH_BUTTON_ON, BSP_BUTTON_ACTION_RELEASE, BSP_EVENT_KEY_1 );
+
+#if SWITCH_PERSONALITY_BUTTON_COUNT > 1
+
+    bsp_event_to_button_action_assign( LIGHT_SWITCH_BUTTON_OFF, BSP_BUTTON_ACTION_PUSH, BSP_EVENT_KEY_2 );
+    bsp_event_to_button_action_assign( LIGHT_SWITCH_BUTTON_OFF, BSP_BUTTON_ACTION_RELEASE, BSP_EVENT_KEY_3 );
+
+    bsp_event_to_button_action_assign( LIGHT_LEVEL_BUTTON_UP, BSP_BUTTON_ACTION_PUSH, BSP_EVENT_KEY_4 );
+    bsp_event_to_button_action_assign( LIGHT_LEVEL_BUTTON_UP, BSP_BUTTON_ACTION_RELEASE, BSP_EVENT_KEY_5 );
+
+    bsp_event_to_button_action_assign( LIGHT_LEVEL_BUTTON_DOWN, BSP_BUTTON_ACTION_PUSH, BSP_EVENT_KEY_6 );
+    bsp_event_to_button_action_assign( LIGHT_LEVEL_BUTTON_DOWN, BSP_BUTTON_ACTION_RELEASE, BSP_EVENT_KEY_7 );
+#endif
+
+    bsp_board_leds_off();
+}
+
+
+
+/**@brief Function for starting a battery measurement, unless the offset calibration is running.
+ *
+ * @param[in]   p_ctx   Switch the battery belongs to.
+ */
+static void battery_level_sample(switch_ctx_t * p_ctx)
+{
+    ret_code_t err_code;
+
+    if (p_ctx->battery.calibrating)
+    {
+        p_ctx->battery.sample_pending = ZB_TRUE;
+        return;
+    }
+
+    err_code = nrf_drv_saadc_sample();
+    APP_ERROR_CHECK(err_code);
+}
+
+/**@brief Function for passing a battery sample through the exponential moving average filter.
+ *
+ * @param[inout] p_filtered_mv   Filter state, in mV with ADC_EMA_FRAC_BITS fractional bits. 0 seeds the filter.
+ * @param[in]    adc_result      Raw conversion result.
+ *
+ * @return Filtered battery voltage in mV.
+ */
+static zb_uint16_t battery_level_filter(zb_uint32_t * p_filtered_mv, nrf_saadc_value_t adc_result)
+{
+    zb_uint32_t sample_mv = ADC_RESULT_IN_MILLI_VOLTS( MAX( adc_result, 0 ) ) + DIODE_FWD_VOLT_DROP_MILLIVOLTS;
+
+    if (*p_filtered_mv == 0)
+    {
+        *p_filtered_mv = sample_mv << ADC_EMA_FRAC_BITS;
+    }
+    else
+    {
+        zb_int32_t error = (zb_int32_t)( sample_mv << ADC_EMA_FRAC_BITS ) - (zb_int32_t)*p_filtered_mv;
+        *p_filtered_mv += error / ( 1 << ADC_EMA_SHIFT );
+    }
+
+    return ( *p_filtered_mv + ( 1 << ( ADC_EMA_FRAC_BITS - 1 ) ) ) >> ADC_EMA_FRAC_BITS;
+}
+
+/**@brief Function for powering down the SAADC at the end of a measurement window.
+ *
+ * @details Called from the main loop once the results have been consumed. The offset calibration
+ *          is kept by the peripheral while it is disabled, the interval is tracked in
+ *          meas_since_calibration.
+ *
+ * @param[in]   p_ctx   Switch the battery belongs to.
+ */
+static void battery_adc_release(switch_ctx_t * p_ctx)
+{
+    if (!p_ctx->battery.active || p_ctx->battery.calibrating)
+    {
+        return;
+    }
+
+    nrf_drv_saadc_uninit();
+    p_ctx->battery.active = ZB_FALSE;
+}
+
+/**@brief Function for filtering new battery samples and updating the Power Config attributes.
+ *
+ * @details Called from the main loop, as the ZCL attribute API must not be used from interrupt
+ *          context. The estimate is updated once per measurement window: after the idle sample,
+ *          and the loaded sample if one is armed, have been filtered. When a sample taken during
+ *          radio TX is available, the remaining capacity is estimated from the loaded voltage, as
+ *          a worn coin cell shows up there first. The estimate is then fused with the coulomb
+ *          counter, and its commit to NVRAM is scheduled when it changes.
+ *
+ * @param[in]   p_ctx   Switch the battery belongs to.
+ */
+static void battery_level_update(switch_ctx_t * p_ctx)
+{
+    uint16_t   batt_lvl_in_milli_volts;
+    zb_uint8_t remaining;
+    zb_uint8_t voltage;
+
+    if (p_ctx->battery.result_ready)
+    {
+        p_ctx->battery.result_ready = ZB_FALSE;
+        p_ctx->battery.update_due   = ZB_TRUE;
+        batt_lvl_in_milli_volts = battery_level_filter( &p_ctx->battery.filtered_mv, p_ctx->battery.result );
+        NRF_LOG_INFO( "ADC: Battery at %dmV (idle)", batt_lvl_in_milli_volts );
+    }
+
+    if (p_ctx->battery.loaded_result_ready)
+    {
+        p_ctx->battery.loaded_result_ready = ZB_FALSE;
+        batt_lvl_in_milli_volts = battery_level_filter( &p_ctx->battery.filtered_loaded_mv, p_ctx->battery.loaded_result );
+        NRF_LOG_INFO( "ADC: Battery at %dmV (TX load)", batt_lvl_in_milli_volts );
+    }
+
+    if (p_ctx->battery.tx_sample_armed)
+    {
+        /* Wait for the loaded sample of this window. */
+        return;
+    }
+
+    battery_adc_release(p_ctx);
+
+    if (!p_ctx->battery.update_due)
+    {
+        return;
+    }
+    p_ctx->battery.update_due = ZB_FALSE;
+
+    if (p_ctx->battery.filtered_loaded_mv != 0)
+    {
+        batt_lvl_in_milli_volts = p_ctx->battery.filtered_loaded_mv >> ADC_EMA_FRAC_BITS;
+        remaining = battery_remaining_estimate( batt_lvl_in_milli_volts, BATTERY_TX_LOAD_MICROAMPS,
+                                                p_ctx->zha_pwrconf_serv_attr.size,
+                                                p_ctx->zha_pwrconf_serv_attr.quantity );
+    }
+    else
+    {
+        batt_lvl_in_milli_volts = p_ctx->battery.filtered_mv >> ADC_EMA_FRAC_BITS;
+        remaining = battery_remaining_estimate( batt_lvl_in_milli_volts, BATTERY_MEAS_LOAD_MICROAMPS,
+                                                p_ctx->zha_pwrconf_serv_attr.size,
+                                                p_ctx->zha_pwrconf_serv_attr.quantity );
+    }
+
+    remaining = battery_observer_update(&p_ctx->charge, p_ctx->zha_pwrconf_serv_attr.size, remaining);
+    if (remaining != p_ctx->charge.persisted)
+    {
+        p_ctx->charge.persisted = remaining;
+        p_ctx->nvram_dirty      = ZB_TRUE;
+        switch_nvram_commit_schedule(p_ctx);
+    }
+
+    /* BatteryVoltage reports the idle voltage, in 100 mV units. */
+    voltage = (zb_uint8_t)( ( ( p_ctx->battery.filtered_mv >> ADC_EMA_FRAC_BITS ) + 50 ) / 100 );
+
+#if SWITCH_ZHA_EP_ENABLED
+    /* Only touch attributes that changed - whether a change is worth a report is decided by the
+     * reporting configuration (see battery_reporting_configure). */
+    if (voltage != p_ctx->zha_pwrconf_serv_attr.voltage)
+    {
+        ZB_ZCL_SET_ATTRIBUTE( LIGHT_SWITCH_ZHA_ENDPOINT,
+            ZB_ZCL_CLUSTER_ID_POWER_CONFIG,
+            ZB_ZCL_CLUSTER_SERVER_ROLE,
+            ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_VOLTAGE_ID,
+            &voltage,
+            ZB_FALSE);
+    }
+
+    if (remaining != p_ctx->zha_pwrconf_serv_attr.remaining)
+    {
+        ZB_ZCL_SET_ATTRIBUTE( LIGHT_SWITCH_ZHA_ENDPOINT,
+            ZB_ZCL_CLUSTER_ID_POWER_CONFIG,
+            ZB_ZCL_CLUSTER_SERVER_ROLE,
+            ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_REMAINING_ID,
+            &remaining,
+            ZB_FALSE);
+    }
+#else
+    p_ctx->zha_pwrconf_serv_attr.voltage   = voltage;
+    p_ctx->zha_pwrconf_serv_attr.remaining = remaining;
+#endif
+
+    battery_alarm_evaluate( p_ctx, p_ctx->battery.filtered_mv >> ADC_EMA_FRAC_BITS, remaining );
+}
+
+#if SWITCH_ZHA_EP_ENABLED
+/**@brief Callback freeing the buffer of a sent battery alarm.
+ */
+static zb_void_t battery_alarm_sent_cb(zb_uint8_t param)
+{
+    ZB_FREE_BUF_BY_REF(param);
+}
+
+/**@brief Function for sending an Alarms cluster notification to the bridge.
+ *
+ * @param[in]   param        Non-zero reference to ZigBee stack buffer used to construct the command.
+ * @param[in]   alarm_code   ZCL alarm code for the Power Configuration cluster.
+ */
+static zb_void_t battery_alarm_send(zb_uint8_t param, zb_uint16_t alarm_code)
+{
+    zb_buf_t   * p_buf = ZB_BUF_FROM_REF(param);
+    zb_uint8_t * p_cmd;
+    zb_uint8_t   frame_ctrl;
+    zb_uint16_t  addr = PHILIPS_BRIDGE_SHORT_ADDR;
+
+    frame_ctrl = ZB_ZCL_CONSTRUCT_FRAME_CONTROL(
+        ZB_ZCL_FRAME_TYPE_CLUSTER_SPECIFIC,
+        ZB_ZCL_NOT_MANUFACTURER_SPECIFIC,
+        ZB_ZCL_FRAME_DIRECTION_TO_CLI,
+        1 );
+
+    p_cmd = (zb_uint8_t *)zb_zcl_start_command_header(p_buf, frame_ctrl, 0, BATTERY_ALARM_CMD_CODE, NULL);
+    ZB_ZCL_PACKET_PUT_DATA8(p_cmd, (zb_uint8_t)alarm_code);
+    ZB_ZCL_PACKET_PUT_DATA16_VAL(p_cmd, ZB_ZCL_CLUSTER_ID_POWER_CONFIG);
+    ZB_ZCL_FINISH_PACKET(p_buf, p_cmd)
+    ZB_ZCL_SEND_COMMAND_SHORT(
+        p_buf, addr,
+        ZB_APS_ADDR_MODE_16_ENDP_PRESENT, PHILIPS_BRIDGE_ZHA_ENDPOINT,
+        LIGHT_SWITCH_ZHA_ENDPOINT, ZB_AF_HA_PROFILE_ID,
+        ZB_ZCL_CLUSTER_ID_ALARMS, battery_alarm_sent_cb );
+    m_device_ctx.charge.tx_frames++;
+}
+#endif
 
-        buttonTransitionState = m_device_ctx.button.longHold ? 0x03 : 0x02;
+/**@brief Function for limiting the runtime log level of every module.
+ *
+ * @details Each module logs up to the lower of its configured level and the limit. Messages
+ *          filtered out are dropped where they are logged, before any formatting or backend
+ *          output. The configured level is the one the module was built with, which is also the
+ *          level it had before the limit was applied, so a limit of NRF_LOG_SEVERITY_DEBUG restores
+ *          it.
+ *
+ * @param[in]   limit   Most verbose severity any module may log.
+ */
+static void switch_log_level_limit(nrf_log_severity_t limit)
+{
+#if SWITCH_LOG_BACKENDS_ENABLED && NRF_LOG_FILTERS_ENABLED
+    for (zb_uint8_t i = 0; i < ARRAY_SIZE(m_log_backends); i++)
+    {
+        uint32_t backend_id = nrf_log_backend_id_get(m_log_backends[i]);
 
-        zb_time_t eventTimeBeaconInterval = ZB_TIME_SUBTRACT( ZB_TIMER_GET(), m_device_ctx.button.timestamp );
-        zb_uint16_t eventTimeMs = ZB_TIME_BEACON_INTERVAL_TO_MSEC( eventTimeBeaconInterval );
-        buttonTime = m_device_ctx.button.longHold ? (zb_uint8_t) ( eventTimeMs / 100 ) : 0x01; 
-        
+        for (uint32_t module_id = 0; module_id < nrf_log_module_cnt_get(); module_id++)
+        {
+            nrf_log_severity_t configured =
+                (nrf_log_severity_t)nrf_log_module_filter_get(backend_id, module_id, false, false);
+
+            nrf_log_module_filter_set(backend_id, module_id, MIN(configured, limit));
+        }
     }
-    else if( !m_device_ctx.button.in_progress && buttonPress == 0 ){
-        // Button released when no command-event chain was in progress
-        return;
-    } else{
+#else
+    UNUSED_PARAMETER(limit);
+#endif
+}
+
+/**@brief Function for switching the reduced-power profile on or off.
+ *
+ * @details The reduced-power profile polls the parent less often, repeats button-hold events
+ *          more slowly and only produces log messages up to SWITCH_LOW_POWER_LOG_LEVEL.
+ */
+static void switch_low_power_set(switch_ctx_t * p_ctx, zb_bool_t enable)
+{
+    if (enable == p_ctx->low_power)
+    {
         return;
     }
 
-    // Encode the button info for the 16-bit callback parameter
-    zb_uint16_t buttonInfoEnc = ENCODE_BUTTON_INFO( buttonId, buttonTransitionState, buttonTime );
-
-    zb_err_code = ZB_GET_OUT_BUF_DELAYED2( sendHueButtonUpdateCommand, buttonInfoEnc );
-    ZB_ERROR_CHECK(zb_err_code);
+    NRF_LOG_WARNING( "Reduced-power profile %s", enable ? "on" : "off" );
+    NRF_LOG_FLUSH();
+    p_ctx->low_power = enable;
 
+    switch_log_level_limit(enable ? SWITCH_LOW_POWER_LOG_LEVEL : NRF_LOG_SEVERITY_DEBUG);
+    switch_poll_interval_update(p_ctx);
 }
 
-/**@brief Function for initializing LEDs and buttons.
+/**@brief Function for updating the battery alarm state.
+ *
+ * @details The levels are evaluated by battery_alarm_state_evaluate. Newly raised levels enabled
+ *          in BatteryAlarmMask are notified to the bridge through the Alarms cluster while the
+ *          switch is joined, when the ZHA endpoint is built.
+ *
+ * @param[in]   p_ctx        Switch whose battery is evaluated.
+ * @param[in]   battery_mv   Filtered idle battery voltage in mV.
+ * @param[in]   remaining    BatteryPercentageRemaining value (0.5% units).
  */
-static zb_void_t leds_buttons_init(void)
+static void battery_alarm_evaluate(switch_ctx_t * p_ctx, zb_uint16_t battery_mv, zb_uint8_t remaining)
 {
-    ret_code_t error_code;
-
-    /* Initialize LEDs and buttons - use BSP to control them. */
-    error_code = bsp_init(BSP_INIT_LEDS | BSP_INIT_BUTTONS, buttons_handler);
-    APP_ERROR_CHECK(error_code);
-    /* By default the bsp_init attaches BSP_KEY_EVENTS_{0-4} to the PUSH events of the corresponding buttons. */
-    bsp_event_to_button_action_assign( LIGHT_SWITCH_BUTTON_ON, BSP_BUTTON_ACTION_PUSH, BSP_EVENT_KEY_0 );
-    bsp_event_to_button_action_assign( LIGHT_SWITCH_BUTTON_ON, BSP_BUTTON_ACTION_RELEASE, BSP_EVENT_KEY_1 );
+    zb_zcl_power_config_attrs_ext_t * p_attrs = &p_ctx->zha_pwrconf_serv_attr;
+    const zb_uint8_t volt_thr[BATTERY_ALARM_LEVELS] =
+        { p_attrs->voltage_min_threshold, p_attrs->threshold1, p_attrs->threshold2, p_attrs->threshold3 };
+    const zb_uint8_t pct_thr[BATTERY_ALARM_LEVELS] =
+        { p_attrs->min_threshold, p_attrs->percent_threshold1, p_attrs->percent_threshold2, p_attrs->percent_threshold3 };
+    zb_uint32_t old_state = (zb_uint32_t)p_attrs->alarm_state;
+    zb_uint32_t new_state = battery_alarm_state_evaluate(volt_thr, pct_thr, old_state, battery_mv, remaining);
+    zb_uint8_t  level;
+
+    for (level = 0; level < BATTERY_ALARM_LEVELS; level++)
+    {
+        zb_uint32_t bit = 1UL << level;
 
-    bsp_event_to_button_action_assign( LIGHT_SWITCH_BUTTON_OFF, BSP_BUTTON_ACTION_PUSH, BSP_EVENT_KEY_2 );
-    bsp_event_to_button_action_assign( LIGHT_SWITCH_BUTTON_OFF, BSP_BUTTON_ACTION_RELEASE, BSP_EVENT_KEY_3 );
+        if ((new_state & bit) && !(old_state & bit) && (p_attrs->alarm_mask & bit))
+        {
+            NRF_LOG_WARNING( "Battery alarm level %d raised at %dmV", level, battery_mv );
+#if SWITCH_ZHA_EP_ENABLED
+            if (p_ctx->nwk_joined)
+            {
+                zb_ret_t zb_err_code = ZB_GET_OUT_BUF_DELAYED2(battery_alarm_send, BATTERY_ALARM_CODE_BASE + level);
+                if (zb_err_code != RET_OK)
+                {
+                    NRF_LOG_WARNING( "Could not queue battery alarm, status %d", zb_err_code );
+                }
+            }
+#endif
+        }
+    }
 
-    bsp_event_to_button_action_assign( LIGHT_LEVEL_BUTTON_UP, BSP_BUTTON_ACTION_PUSH, BSP_EVENT_KEY_4 );
-    bsp_event_to_button_action_assign( LIGHT_LEVEL_BUTTON_UP, BSP_BUTTON_ACTION_RELEASE, BSP_EVENT_KEY_5 );
+    if (new_state != old_state)
+    {
+#if SWITCH_ZHA_EP_ENABLED
+        ZB_ZCL_SET_ATTRIBUTE( LIGHT_SWITCH_ZHA_ENDPOINT,
+            ZB_ZCL_CLUSTER_ID_POWER_CONFIG,
+            ZB_ZCL_CLUSTER_SERVER_ROLE,
+            ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_ALARM_STATE_ID,
+            (zb_uint8_t *)&new_state,
+            ZB_FALSE);
+#else
+        p_attrs->alarm_state = new_state;
+#endif
+    }
 
-    bsp_event_to_button_action_assign( LIGHT_LEVEL_BUTTON_DOWN, BSP_BUTTON_ACTION_PUSH, BSP_EVENT_KEY_6 );
-    bsp_event_to_button_action_assign( LIGHT_LEVEL_BUTTON_DOWN, BSP_BUTTON_ACTION_RELEASE, BSP_EVENT_KEY_7 );
+    switch_low_power_set(p_ctx, (new_state & BATTERY_LOW_POWER_ALARM_STATES) ? ZB_TRUE : ZB_FALSE);
+}
 
-    bsp_board_leds_off();
+#if SWITCH_ZHA_EP_ENABLED
+/**@brief Function for installing the default reporting configuration of one battery attribute.
+ *
+ * @details The configuration is not overridden if one already exists, either restored from NVRAM
+ *          or received from the bridge in a Configure Reporting command.
+ */
+static void battery_reporting_put_default(zb_uint16_t attr_id, zb_uint8_t delta)
+{
+    zb_zcl_reporting_info_t rep_info;
+    zb_ret_t                zb_err_code;
+
+    UNUSED_RETURN_VALUE(ZB_BZERO(&rep_info, sizeof(rep_info)));
+
+    rep_info.direction                    = ZB_ZCL_CONFIGURE_REPORTING_SEND_REPORT;
+    rep_info.ep                           = LIGHT_SWITCH_ZHA_ENDPOINT;
+    rep_info.cluster_id                   = ZB_ZCL_CLUSTER_ID_POWER_CONFIG;
+    rep_info.cluster_role                 = ZB_ZCL_CLUSTER_SERVER_ROLE;
+    rep_info.attr_id                      = attr_id;
+    rep_info.dst.short_addr               = PHILIPS_BRIDGE_SHORT_ADDR;
+    rep_info.dst.endpoint                 = PHILIPS_BRIDGE_ZHA_ENDPOINT;
+    rep_info.dst.profile_id               = ZB_AF_HA_PROFILE_ID;
+    rep_info.u.send_info.min_interval     = BATTERY_REPORT_MIN_INTERVAL;
+    rep_info.u.send_info.max_interval     = BATTERY_REPORT_MAX_INTERVAL;
+    rep_info.u.send_info.def_min_interval = BATTERY_REPORT_MIN_INTERVAL;
+    rep_info.u.send_info.def_max_interval = BATTERY_REPORT_MAX_INTERVAL;
+    rep_info.u.send_info.delta.u8         = delta;
+
+    zb_err_code = zb_zcl_put_reporting_info(&rep_info, ZB_FALSE);
+    if (zb_err_code != RET_OK)
+    {
+        NRF_LOG_WARNING( "Could not configure reporting of attr 0x%04x, status %d", attr_id, zb_err_code );
+    }
 }
 
+/**@brief Function for installing the default battery reporting configuration.
+ *
+ * @details Reports are sent on a change of at least BATTERY_REPORT_REMAINING_DELTA or
+ *          BATTERY_REPORT_VOLTAGE_DELTA, no more often than BATTERY_REPORT_MIN_INTERVAL, and
+ *          otherwise as a heartbeat every BATTERY_REPORT_MAX_INTERVAL. The stack keeps the
+ *          reporting configuration in NVRAM.
+ */
+static void battery_reporting_configure(void)
+{
+    battery_reporting_put_default(ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_VOLTAGE_ID, BATTERY_REPORT_VOLTAGE_DELTA);
+    battery_reporting_put_default(ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_REMAINING_ID, BATTERY_REPORT_REMAINING_DELTA);
 
+    UNUSED_RETURN_VALUE(zb_nvram_write_dataset(ZB_NVRAM_ZCL_REPORTING_DATA));
+}
+#endif
 
 /**@brief Function for handling the ADC interrupt.
  *
- * @details  This function will fetch the conversion result from the ADC, convert the value into
- *           percentage and send it to peer.
+ * @details  This function will fetch the conversion result from the ADC and hand it over to the
+ *           main loop, which then releases the SAADC (see battery_adc_release).
+ *
+ *           With BATTERY_MEAS_ON_TX_ENABLED, each idle measurement queues the buffer again and
+ *           arms the PPI channel, so that the next radio transmission starts a second conversion
+ *           under load. The SAADC low power mode then triggers the SAMPLE task as soon as the
+ *           SAADC has started. The SAADC stays up until then, or until the next timer expiry.
  */
 void saadc_event_handler(nrf_drv_saadc_evt_t const * p_event)
 {
+    switch_ctx_t * p_ctx = &m_device_ctx;
+#if BATTERY_MEAS_ON_TX_ENABLED
+    uint32_t err_code;
+#endif
+
     if (p_event->type == NRF_DRV_SAADC_EVT_DONE)
     {
-        nrf_saadc_value_t adc_result;
-        uint16_t          batt_lvl_in_milli_volts;
-        uint32_t          err_code;
-        zb_uint16_t       batt_lvl_pcnt;
+        if (p_ctx->battery.tx_sample_armed)
+        {
+#if BATTERY_MEAS_ON_TX_ENABLED
+            err_code = nrf_drv_ppi_channel_disable(m_battery_ppi_channel);
+            APP_ERROR_CHECK(err_code);
+#endif
+            p_ctx->battery.tx_sample_armed     = ZB_FALSE;
+            p_ctx->battery.loaded_result       = p_event->data.done.p_buffer[0];
+            p_ctx->battery.loaded_result_ready = ZB_TRUE;
+            return;
+        }
 
-        NRF_LOG_INFO( "ADC Event handler" );
-        adc_result = p_event->data.done.p_buffer[0];
+        p_ctx->battery.result = p_event->data.done.p_buffer[0];
+        ++p_ctx->battery.meas_since_calibration;
 
+#if BATTERY_MEAS_ON_TX_ENABLED
         err_code = nrf_drv_saadc_buffer_convert(p_event->data.done.p_buffer, 1);
         APP_ERROR_CHECK(err_code);
 
-        batt_lvl_in_milli_volts = ADC_RESULT_IN_MILLI_VOLTS( adc_result ) + 
-                                  DIODE_FWD_VOLT_DROP_MILLIVOLTS;
-        NRF_LOG_INFO( "ADC: Battery at %dmV", batt_lvl_in_milli_volts );
-        batt_lvl_pcnt = battery_level_in_percent( batt_lvl_in_milli_volts );
-        m_device_ctx.zha_pwrconf_serv_attr.remaining = batt_lvl_pcnt * 2;
-
-        NRF_LOG_INFO( "ADC: Battery at %dmV.", batt_lvl_in_milli_volts );
-        //NRF_LOG_INFO( "ADC: Setting battery level to %d", m_device_ctx.zha_pwrconf_serv_attr.remaining );
-        ZB_ZCL_SET_ATTRIBUTE( LIGHT_SWITCH_ZHA_ENDPOINT, 
-            ZB_ZCL_CLUSTER_ID_POWER_CONFIG,    
-            ZB_ZCL_CLUSTER_SERVER_ROLE,  
-            ZB_ZCL_ATTR_POWER_CONFIG_BATTERY_REMAINING_ID,
-            ( zb_uint8_t * )&m_device_ctx.zha_pwrconf_serv_attr.remaining,                       
-            ZB_FALSE);
+        p_ctx->battery.tx_sample_armed = ZB_TRUE;
+        err_code = nrf_drv_ppi_channel_enable(m_battery_ppi_channel);
+        APP_ERROR_CHECK(err_code);
+#endif
+        p_ctx->battery.result_ready = ZB_TRUE;
+    }
+    else if (p_event->type == NRF_DRV_SAADC_EVT_CALIBRATEDONE)
+    {
+        p_ctx->battery.calibration_done = ZB_TRUE;
+    }
+}
 
-        
+/**@brief Function for resuming battery measurements once the SAADC offset calibration is done.
+ *
+ * @details Called from the main loop rather than from the SAADC interrupt, as in the SDK SAADC
+ *          example, so no driver call is made from within the SAADC event handler.
+ *
+ * @param[in]   p_ctx   Switch the battery belongs to.
+ */
+static void battery_adc_calibration_complete(switch_ctx_t * p_ctx)
+{
+    ret_code_t err_code;
+
+    NRF_LOG_INFO( "ADC: Offset calibration done" );
+    p_ctx->battery.calibration_done       = ZB_FALSE;
+    p_ctx->battery.calibrating            = ZB_FALSE;
+    p_ctx->battery.meas_since_calibration = 0;
+
+    err_code = nrf_drv_saadc_buffer_convert(&adc_buf, 1);
+    APP_ERROR_CHECK(err_code);
+
+    if (p_ctx->battery.sample_pending)
+    {
+        p_ctx->battery.sample_pending = ZB_FALSE;
+        battery_level_sample(p_ctx);
     }
 }
 
-/**@brief Function for configuring ADC to do battery level conversion.
+/**@brief Function for bringing up the SAADC and starting a battery measurement.
+ *
+ * @details The SAADC is only initialized for the duration of a measurement window. The offset
+ *          calibration is run at the start of every ADC_CALIBRATION_INTERVAL-th window, before the
+ *          conversion. The result is written to adc_buf through EasyDMA.
+ *
+ * @param[in]   p_ctx   Switch the battery belongs to.
  */
-static void adc_configure(void)
+static void battery_adc_start(switch_ctx_t * p_ctx)
 {
-    ret_code_t err_code = nrf_drv_saadc_init( NULL, saadc_event_handler );
+    ret_code_t             err_code;
+    nrf_drv_saadc_config_t saadc_config = NRF_DRV_SAADC_DEFAULT_CONFIG;
+
+    if (p_ctx->battery.active)
+    {
+        /* Still up from the previous window, waiting for the loaded sample. */
+        battery_level_sample(p_ctx);
+        return;
+    }
+
+    saadc_config.resolution     = ADC_RESOLUTION;
+    saadc_config.oversample     = ADC_OVERSAMPLE;
+    saadc_config.low_power_mode = ADC_LOW_POWER_MODE;
+    err_code = nrf_drv_saadc_init( &saadc_config, saadc_event_handler );
     APP_ERROR_CHECK(err_code);
 
     nrf_saadc_channel_config_t config =
         NRF_DRV_SAADC_DEFAULT_CHANNEL_CONFIG_SE(NRF_SAADC_INPUT_VDD);
+    /* VDD is a low impedance source - the shortest acquisition time is sufficient. */
+    config.acq_time = NRF_SAADC_ACQTIME_3US;
+    config.burst    = NRF_SAADC_BURST_ENABLED;
     err_code = nrf_drv_saadc_channel_init(0, &config);
     APP_ERROR_CHECK(err_code);
 
-    err_code = nrf_drv_saadc_buffer_convert(&adc_buf[0], 1);
+    p_ctx->battery.active = ZB_TRUE;
+
+    if (p_ctx->battery.meas_since_calibration >= ADC_CALIBRATION_INTERVAL)
+    {
+        p_ctx->battery.calibrating    = ZB_TRUE;
+        p_ctx->battery.sample_pending = ZB_TRUE;
+        err_code = nrf_drv_saadc_calibrate_offset();
+        APP_ERROR_CHECK(err_code);
+        return;
+    }
+
+    err_code = nrf_drv_saadc_buffer_convert(&adc_buf, 1);
     APP_ERROR_CHECK(err_code);
 
-    err_code = nrf_drv_saadc_buffer_convert(&adc_buf[1], 1);
+    battery_level_sample(p_ctx);
+}
+
+/**@brief Function for configuring ADC to do battery level conversion.
+ *
+ * @details The resolution, oversampling and low power mode are set by battery_adc_start
+ *          (ADC_RESOLUTION, ADC_OVERSAMPLE, ADC_LOW_POWER_MODE), the sdk_config.h defaults are
+ *          left alone. The channel runs in burst mode, so that a single SAMPLE task produces one oversampled
+ *          result. The SAADC itself is only brought up for each measurement (see
+ *          battery_adc_start). The first measurement is taken right away, after the initial
+ *          offset calibration.
+ */
+static void adc_configure(void)
+{
+    switch_ctx_t * p_ctx = &m_device_ctx;
+#if BATTERY_MEAS_ON_TX_ENABLED
+    ret_code_t err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_ERROR_MODULE_ALREADY_INITIALIZED)
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+
+    err_code = nrf_drv_ppi_channel_alloc(&m_battery_ppi_channel);
     APP_ERROR_CHECK(err_code);
 
-    err_code = nrf_drv_saadc_sample();
+    err_code = nrf_drv_ppi_channel_assign(m_battery_ppi_channel,
+                                          nrf_radio_event_address_get(NRF_RADIO_EVENT_TXREADY),
+                                          nrf_saadc_task_address_get(NRF_SAADC_TASK_START));
     APP_ERROR_CHECK(err_code);
+#endif
+
+    p_ctx->battery.meas_since_calibration = ADC_CALIBRATION_INTERVAL;
+    battery_adc_start(p_ctx);
 }
 
-/**@brief Function for handling the Battery measurement timer timeout.
+/**@brief Function for handling the Battery measurement timeout.
  *
- * @details This function will be called each time the battery level measurement timer expires.
+ * @details This function will be called each time a battery level measurement is due.
  *          This function will start the ADC.
  *
- * @param[in] p_context   Pointer used for passing some arbitrary information (context) from the
- *                        app_start_timer() call to the timeout handler.
+ * @param[in] param   Not used.
  */
-static void battery_level_meas_timeout_handler(void * p_context)
+static zb_void_t battery_level_meas_timeout_handler(zb_uint8_t param)
 {
-    UNUSED_PARAMETER(p_context);
+    switch_ctx_t * p_ctx = &m_device_ctx;
+
+    UNUSED_PARAMETER(param);
     NRF_LOG_INFO( "ADC timer CB" );
-    ret_code_t err_code;
-    err_code = nrf_drv_saadc_sample();
-    APP_ERROR_CHECK(err_code);
+#if BATTERY_MEAS_ON_TX_ENABLED
+    if (p_ctx->battery.tx_sample_armed)
+    {
+        /* No transmission since the last measurement - close the window with the idle sample
+         * alone, then take the next one. */
+        ret_code_t err_code = nrf_drv_ppi_channel_disable(m_battery_ppi_channel);
+        APP_ERROR_CHECK(err_code);
+        p_ctx->battery.tx_sample_armed = ZB_FALSE;
+        battery_level_update(p_ctx);
+    }
+#endif
+    battery_adc_start(p_ctx);
+}
+
+/**@brief Function for logging the wakeup statistics of the last SWITCH_WAKEUP_REPORT_INTERVAL.
+ *
+ * @details Logged as "WAKE,<wakeups>,<coalesced>,<forced>", so that runs with different timing
+ *          settings can be compared.
+ */
+static zb_void_t switch_wakeup_report(zb_uint8_t param)
+{
+    UNUSED_PARAMETER(param);
+
+    NRF_LOG_INFO( "WAKE,%u,%u,%u", m_device_ctx.wakeup.wakeups, m_device_ctx.wakeup.coalesced,
+                  m_device_ctx.wakeup.forced );
+    ZB_BZERO( &m_device_ctx.wakeup, sizeof(m_device_ctx.wakeup) );
+}
+
+/* Deferrable periodic work. Instead of a timer of its own, each item becomes due after its period
+ * and is then run on the next wakeup that happens anyway (usually a parent poll). Only if none
+ * happens within the tolerance does the deadline alarm wake the device for it. */
+typedef enum
+{
+    SWITCH_DEFERRED_BATTERY_MEAS,
+    SWITCH_DEFERRED_WAKEUP_REPORT,
+#if SWITCH_PROFILING_ENABLED
+    SWITCH_DEFERRED_PROFILE_REPORT,
+#endif
+    SWITCH_DEFERRED_COUNT
+} switch_deferred_id_t;
+
+typedef struct
+{
+    zb_callback_t handler;
+    zb_time_t     period;
+    zb_time_t     tolerance;
+    zb_time_t     due;
+    zb_bool_t     active;
+} switch_deferred_work_t;
+
+static switch_deferred_work_t m_deferred_work[SWITCH_DEFERRED_COUNT] =
+{
+    [SWITCH_DEFERRED_BATTERY_MEAS]   = { battery_level_meas_timeout_handler, BATTERY_LEVEL_MEAS_INTERVAL,   BATTERY_LEVEL_MEAS_TOLERANCE   },
+    [SWITCH_DEFERRED_WAKEUP_REPORT]  = { switch_wakeup_report,               SWITCH_WAKEUP_REPORT_INTERVAL, SWITCH_WAKEUP_REPORT_TOLERANCE },
+#if SWITCH_PROFILING_ENABLED
+    [SWITCH_DEFERRED_PROFILE_REPORT] = { switch_profile_report, SWITCH_PROFILING_REPORT_INTERVAL, SWITCH_PROFILING_REPORT_TOLERANCE },
+#endif
+};
+
+static zb_void_t switch_deferred_deadline(zb_uint8_t param);
+
+/**@brief Function for scheduling the deadline alarm for the earliest deferrable work item.
+ */
+static void switch_deferred_schedule(void)
+{
+    zb_time_t now   = ZB_TIMER_GET();
+    zb_time_t delay = 0;
+    zb_bool_t any   = ZB_FALSE;
+    zb_ret_t  zb_err_code;
+
+    for (zb_uint8_t i = 0; i < SWITCH_DEFERRED_COUNT; i++)
+    {
+        switch_deferred_work_t * p_work   = &m_deferred_work[i];
+        zb_time_t                deadline = ZB_TIME_ADD( p_work->due, p_work->tolerance );
+        zb_time_t                left;
+
+        if (!p_work->active)
+        {
+            continue;
+        }
+
+        left = ZB_TIME_GE( now, deadline ) ? 0 : ZB_TIME_SUBTRACT( deadline, now );
+        if (!any || left < delay)
+        {
+            delay = left;
+            any   = ZB_TRUE;
+        }
+    }
+
+    UNUSED_RETURN_VALUE(ZB_SCHEDULE_ALARM_CANCEL( switch_deferred_deadline, ZB_ALARM_ANY_PARAM ));
+    if (any)
+    {
+        zb_err_code = ZB_SCHEDULE_ALARM( switch_deferred_deadline, 0, delay );
+        ZB_ERROR_CHECK( zb_err_code );
+    }
+}
+
+/**@brief Function for running all deferrable work items that are due.
+ *
+ * @param[in] forced   ZB_TRUE when called from the deadline alarm, i.e. on a wakeup of its own.
+ *
+ * @return ZB_TRUE if any work was run.
+ */
+static zb_bool_t switch_deferred_run(zb_bool_t forced)
+{
+    zb_time_t now = ZB_TIMER_GET();
+    zb_bool_t ran = ZB_FALSE;
+
+    for (zb_uint8_t i = 0; i < SWITCH_DEFERRED_COUNT; i++)
+    {
+        switch_deferred_work_t * p_work = &m_deferred_work[i];
+
+        if (!p_work->active || !ZB_TIME_GE( now, p_work->due ))
+        {
+            continue;
+        }
+
+        /* Keep the cadence, unless the item fell behind by a whole period. */
+        p_work->due = ZB_TIME_ADD( p_work->due, p_work->period );
+        if (ZB_TIME_GE( now, p_work->due ))
+        {
+            p_work->due = ZB_TIME_ADD( now, p_work->period );
+        }
+
+        p_work->handler( 0 );
+        if (forced)
+        {
+            m_device_ctx.wakeup.forced++;
+        }
+        else
+        {
+            m_device_ctx.wakeup.coalesced++;
+        }
+        ran = ZB_TRUE;
+    }
+
+    if (ran)
+    {
+        switch_deferred_schedule();
+    }
+
+    return ran;
+}
+
+static zb_void_t switch_deferred_deadline(zb_uint8_t param)
+{
+    UNUSED_PARAMETER(param);
+
+    if (!switch_deferred_run( ZB_TRUE ))
+    {
+        switch_deferred_schedule();
+    }
+}
+
+/**@brief Function for (re)starting a deferrable work item, first due one period from now.
+ */
+static void switch_deferred_start(switch_deferred_id_t id)
+{
+    m_deferred_work[id].due    = ZB_TIME_ADD( ZB_TIMER_GET(), m_deferred_work[id].period );
+    m_deferred_work[id].active = ZB_TRUE;
+    switch_deferred_schedule();
 }
 
 /**@brief ZigBee stack event handler.
@@ -846,7 +2975,20 @@ void zboss_signal_handler(zb_uint8_t param)
                 NRF_LOG_INFO("Joined network successfully");
                 bsp_board_led_on(ZIGBEE_NETWORK_STATE_LED);
                 m_device_ctx.nwk_joined = ZB_TRUE;
-                app_timer_start(m_battery_timer_id, BATTERY_LEVEL_MEAS_INTERVAL, NULL);
+#if SWITCH_ZHA_EP_ENABLED
+                battery_reporting_configure();
+#if SWITCH_PERSONALITY_GREEN_POWER
+                zb_err_code = ZB_GET_OUT_BUF_DELAYED(switch_gp_commission);
+                ZB_ERROR_CHECK(zb_err_code);
+#endif
+                zb_err_code = ZB_GET_OUT_BUF_DELAYED(zb_zcl_ota_upgrade_init_client);
+                ZB_ERROR_CHECK(zb_err_code);
+#endif
+                switch_deferred_start(SWITCH_DEFERRED_BATTERY_MEAS);
+                switch_deferred_start(SWITCH_DEFERRED_WAKEUP_REPORT);
+#if SWITCH_PROFILING_ENABLED
+                switch_deferred_start(SWITCH_DEFERRED_PROFILE_REPORT);
+#endif
                // zb_err_code = ZB_SCHEDULE_ALARM(find_light_bulb, param, MATCH_DESC_REQ_START_DELAY);
                // ZB_ERROR_CHECK(zb_err_code);
                 param = 0; // Do not free buffer - it will be reused by find_light_bulb callback
@@ -855,7 +2997,7 @@ void zboss_signal_handler(zb_uint8_t param)
             {
                 NRF_LOG_ERROR("Failed to join network. Status: %d", status);
                 bsp_board_led_off(ZIGBEE_NETWORK_STATE_LED);
-                zb_err_code = ZB_SCHEDULE_ALARM(light_switch_leave_and_join, 0, ZB_TIME_ONE_SECOND);
+                zb_err_code = ZB_SCHEDULE_ALARM(light_switch_leave_and_join, 0, SWITCH_JOIN_RETRY_DELAY);
                 ZB_ERROR_CHECK(zb_err_code);
             }
             break;
@@ -868,6 +3010,14 @@ void zboss_signal_handler(zb_uint8_t param)
                 NRF_LOG_INFO("Network left. Leave type: %d", p_leave_params->leave_type);
                 light_switch_retry_join(p_leave_params->leave_type);
                 m_device_ctx.nwk_joined = ZB_FALSE;
+                light_switch_button_reset( &m_device_ctx );
+#if SWITCH_ZHA_EP_ENABLED
+                /* The client is started again on rejoin; the checkpoint lets it resume. */
+                if (m_device_ctx.ota.active)
+                {
+                    switch_ota_stop( &m_device_ctx );
+                }
+#endif
             }
             else
             {
@@ -879,7 +3029,16 @@ void zboss_signal_handler(zb_uint8_t param)
             {
                 zb_zdo_signal_can_sleep_params_t *can_sleep_params = ZB_ZDO_SIGNAL_GET_PARAMS(p_sg_p, zb_zdo_signal_can_sleep_params_t);
                 NRF_LOG_INFO("Can sleep for %ld ms", can_sleep_params->sleep_tmo);
-                zb_sleep_now();
+                /* Run due deferrable work on this wakeup. If any ran, the stack signals again once
+                 * it is idle, with the sleep time updated. Button events queued from interrupt
+                 * context are run by the main loop before sleeping. */
+                if (!switch_deferred_run(ZB_FALSE) &&
+                    (app_sched_queue_space_get() == SWITCH_SCHED_QUEUE_SIZE))
+                {
+                    zb_sleep_now();
+                    m_device_ctx.wakeup.wakeups++;
+                    m_device_ctx.charge.wakeups++;
+                }
             }
             break;
 
@@ -903,40 +3062,18 @@ void zboss_signal_handler(zb_uint8_t param)
 
 
 void setBasicAttrs( zb_zcl_basic_attrs_ext_hue_t * basicAttrList ){
-    /* Basic cluster attributes data */
-    basicAttrList->zcl_version   = ZB_ZCL_VERSION;
-    basicAttrList->app_version   = BULB_INIT_BASIC_APP_VERSION;
-    basicAttrList->stack_version = BULB_INIT_BASIC_STACK_VERSION;
-    basicAttrList->hw_version    = BULB_INIT_BASIC_HW_VERSION;
-
-    /* Use ZB_ZCL_SET_STRING_VAL to set strings, because the first byte should
+    /* Only the writable Basic attributes are per endpoint, the rest is in m_basic_const_attrs.
+    *
+    * Use ZB_ZCL_SET_STRING_VAL to set strings, because the first byte should
     * contain string length without trailing zero.
     *
     * For example "test" string wil be encoded as:
     *   [(0x4), 't', 'e', 's', 't']
     */
-    ZB_ZCL_SET_STRING_VAL(basicAttrList->mf_name,
-                        BULB_INIT_BASIC_MANUF_NAME,
-                        ZB_ZCL_STRING_CONST_SIZE(BULB_INIT_BASIC_MANUF_NAME));
-
-    ZB_ZCL_SET_STRING_VAL(basicAttrList->model_id,
-                        BULB_INIT_BASIC_MODEL_ID,
-                        ZB_ZCL_STRING_CONST_SIZE(BULB_INIT_BASIC_MODEL_ID));
-
-    ZB_ZCL_SET_STRING_VAL(basicAttrList->date_code,
-                        BULB_INIT_BASIC_DATE_CODE,
-                        ZB_ZCL_STRING_CONST_SIZE(BULB_INIT_BASIC_DATE_CODE));
-
-    basicAttrList->power_source = BULB_INIT_BASIC_POWER_SOURCE;
-
     ZB_ZCL_SET_STRING_VAL(basicAttrList->location_id,
                         BULB_INIT_BASIC_LOCATION_DESC,
                         ZB_ZCL_STRING_CONST_SIZE(BULB_INIT_BASIC_LOCATION_DESC));
 
-    ZB_ZCL_SET_STRING_VAL( basicAttrList->sw_ver,
-                         BULB_INIT_BASIC_SW_VERSION,
-                         ZB_ZCL_STRING_CONST_SIZE( BULB_INIT_BASIC_SW_VERSION ) );
-
     basicAttrList->ph_env = BULB_INIT_BASIC_PH_ENV; 
 } 
 
@@ -944,13 +3081,27 @@ void setBasicAttrs( zb_zcl_basic_attrs_ext_hue_t * basicAttrList ){
  */
 static void bulb_clusters_attr_init(void)
 {
+#if SWITCH_ZLL_EP_ENABLED
     /* Set basic Attr list data */
     setBasicAttrs( &m_device_ctx.zll_basic_client_attr );
     setBasicAttrs( &m_device_ctx.zll_basic_serv_attr );
-    setBasicAttrs( &m_device_ctx.zha_basic_serv_attr );
 
     /* Identify cluster attributes data */
     m_device_ctx.zll_identify_attr.identify_time = ZB_ZCL_IDENTIFY_IDENTIFY_TIME_DEFAULT_VALUE;
+#endif
+
+    /* Power config cluster attributes data */
+    m_device_ctx.zha_pwrconf_serv_attr.size          = BULB_INIT_BATTERY_SIZE;
+    m_device_ctx.zha_pwrconf_serv_attr.quantity      = BULB_INIT_BATTERY_QUANTITY;
+    m_device_ctx.zha_pwrconf_serv_attr.rated_voltage = BULB_INIT_BATTERY_RATED_VOLTAGE;
+    m_device_ctx.zha_pwrconf_serv_attr.voltage_min_threshold = BULB_INIT_BATTERY_VOLTAGE_MIN;
+    m_device_ctx.zha_pwrconf_serv_attr.threshold1    = BULB_INIT_BATTERY_THRESHOLD1;
+    m_device_ctx.zha_pwrconf_serv_attr.threshold2    = BULB_INIT_BATTERY_THRESHOLD2;
+    m_device_ctx.zha_pwrconf_serv_attr.threshold3    = BULB_INIT_BATTERY_THRESHOLD3;
+    m_device_ctx.zha_pwrconf_serv_attr.alarm_mask    = BULB_INIT_BATTERY_ALARM_MASK;
+
+#if SWITCH_ZHA_EP_ENABLED
+    setBasicAttrs( &m_device_ctx.zha_basic_serv_attr );
     m_device_ctx.zha_identify_serv_attr.identify_time = ZB_ZCL_IDENTIFY_IDENTIFY_TIME_DEFAULT_VALUE;
 
     ZB_ZCL_SET_ATTRIBUTE( LIGHT_SWITCH_ZHA_ENDPOINT, 
@@ -969,7 +3120,7 @@ static void bulb_clusters_attr_init(void)
 
     m_device_ctx.zha_basic_serv_attr.philips_device_flag = 1;
 
-    m_device_ctx.zha_tunnelling_serv_attr.philips_type = 0x0001;
+    m_device_ctx.zha_tunnel_serv_attr.philips_type = 0x0001;
     ZB_ZCL_SET_ATTRIBUTE( LIGHT_SWITCH_ZHA_ENDPOINT, 
                           ZB_ZCL_CLUSTER_ID_BASIC,    
                           ZB_ZCL_CLUSTER_SERVER_ROLE,  
@@ -981,7 +3132,7 @@ static void bulb_clusters_attr_init(void)
                           ZB_ZCL_CLUSTER_ID_TUNNEL,    
                           ZB_ZCL_CLUSTER_SERVER_ROLE,  
                           ZB_ZCL_ATTR_TUNNELING_PHILIPS_TYPE_ID,
-                          ( zb_uint8_t * )&m_device_ctx.zha_tunnelling_serv_attr.philips_type,                       
+                          ( zb_uint8_t * )&m_device_ctx.zha_tunnel_serv_attr.philips_type,                       
                           ZB_FALSE);
 
     /* OTA cluster attributes data */
@@ -994,29 +3145,119 @@ static void bulb_clusters_attr_init(void)
     m_device_ctx.zha_otau_attr.downloaded_stack_ver = ZB_ZCL_OTA_UPGRADE_DOWNLOADED_STACK_DEF_VALUE;
     m_device_ctx.zha_otau_attr.image_status = ZB_ZCL_OTA_UPGRADE_IMAGE_STATUS_DEF_VALUE;
     m_device_ctx.zha_otau_attr.manufacturer = ZB_PHILIPS_MANUF_CODE;
-    m_device_ctx.zha_otau_attr.image_type = 0x0000;
+    m_device_ctx.zha_otau_attr.image_type = SWITCH_OTA_IMAGE_TYPE;
     m_device_ctx.zha_otau_attr.min_block_reque = 0;
     m_device_ctx.zha_otau_attr.image_stamp = ZB_ZCL_OTA_UPGRADE_IMAGE_STAMP_MIN_VALUE;
+#endif
               
 }
 
 
 zb_uint8_t zb_zcl_handler_cb( zb_uint8_t param ){
+#if SWITCH_ZHA_EP_ENABLED
+    zb_buf_t            * p_buf      = ZB_BUF_FROM_REF(param);
+    zb_zcl_parsed_hdr_t * p_cmd_info = ZB_GET_BUF_PARAM(p_buf, zb_zcl_parsed_hdr_t);
+
+    /* The OTA client only gets to see the commands of the server after the image type is chosen. */
+    if (p_cmd_info->cluster_id == ZB_ZCL_CLUSTER_ID_OTA_UPGRADE && !p_cmd_info->is_common_command &&
+        p_cmd_info->cmd_direction == ZB_ZCL_FRAME_DIRECTION_TO_CLI)
+    {
+        if (p_cmd_info->cmd_id == ZB_ZCL_CMD_OTA_UPGRADE_IMAGE_NOTIFY_ID)
+        {
+            switch_ota_image_notify(&m_device_ctx, ZB_BUF_BEGIN(p_buf), ZB_BUF_LEN(p_buf));
+        }
+        else if (p_cmd_info->cmd_id == ZB_ZCL_CMD_OTA_UPGRADE_QUERY_NEXT_IMAGE_RESP_ID &&
+                 ZB_BUF_LEN(p_buf) > 0 && *ZB_BUF_BEGIN(p_buf) != ZB_ZCL_STATUS_SUCCESS)
+        {
+            /* No delta built against the running version - the next query is for the full image. */
+            switch_ota_full_image_query(&m_device_ctx);
+        }
+    }
+#else
+    UNUSED_PARAMETER(param);
+#endif
     return ZB_FALSE;
 }
 
+/**@brief Callback restoring the application dataset from NVRAM, called from zboss_start.
+ *
+ * @details The persistent attributes restored here override the defaults set by
+ *          bulb_clusters_attr_init, which runs before the stack is started.
+ */
+static void switch_nvram_read_app_data(zb_uint8_t page, zb_uint32_t pos, zb_uint16_t payload_length)
+{
+    zb_uint16_t length;
+
+    length = switch_nvram_dataset_read(page, pos, payload_length, &m_nvram_data, sizeof(m_nvram_data),
+                                       SWITCH_NVRAM_DATA_VERSION);
+    if (length == 0)
+    {
+        return;
+    }
+
+    if (length >= offsetof(switch_nvram_data_t, location_id))
+    {
+        m_device_ctx.charge.used_uah     = m_nvram_data.battery_used_uah;
+        m_device_ctx.charge.observed_uah = m_nvram_data.battery_used_uah;
+        m_device_ctx.charge.estimate_q   = m_nvram_data.battery_estimate_q;
+        m_device_ctx.charge.seeded       = ZB_TRUE;
+        m_device_ctx.charge.persisted    = (zb_uint8_t)( m_nvram_data.battery_estimate_q >> BATTERY_OBSERVER_FRAC_BITS );
+    }
+
+    /* Attributes missing from a shorter dataset keep their defaults. */
+    switch_nvram_attrs_restore( m_persistent_attrs, ARRAY_SIZE(m_persistent_attrs), &m_nvram_data, length );
+
+#if SWITCH_ZHA_EP_ENABLED
+    if (length == sizeof(m_nvram_data))
+    {
+        m_device_ctx.ota_checkpoint = m_nvram_data.ota;
+        m_device_ctx.ota_hash       = m_nvram_data.ota_hash;
+        switch_ota_checkpoint_restore(&m_device_ctx);
+    }
+#endif
+}
+
+/**@brief Callback writing the application dataset to NVRAM.
+ */
+static zb_ret_t switch_nvram_write_app_data(zb_uint8_t page, zb_uint32_t pos)
+{
+    m_nvram_data.header.version     = SWITCH_NVRAM_DATA_VERSION;
+    m_nvram_data.header.length      = sizeof(m_nvram_data);
+    m_nvram_data.battery_used_uah   = m_device_ctx.charge.used_uah;
+    m_nvram_data.battery_estimate_q = m_device_ctx.charge.estimate_q;
+#if SWITCH_ZHA_EP_ENABLED
+    m_nvram_data.ota                = m_device_ctx.ota_checkpoint;
+    m_nvram_data.ota_hash           = m_device_ctx.ota_hash;
+#endif
+
+    switch_nvram_attrs_store( m_persistent_attrs, ARRAY_SIZE(m_persistent_attrs), &m_nvram_data );
+
+    return zb_osif_nvram_write(page, pos, (zb_uint8_t *)&m_nvram_data, sizeof(m_nvram_data));
+}
+
+static zb_uint16_t switch_nvram_get_app_data_size(void)
+{
+    return sizeof(switch_nvram_data_t);
+}
 
 /**@brief Function for application main entry.
  */
 int main(void)
 {
+#if SWITCH_ZHA_EP_ENABLED
+    ret_code_t     err_code;
+#endif
     zb_ret_t       zb_err_code;
     zb_ieee_addr_t ieee_addr;
 
-    /* Initialize timers, loging system and GPIOs. */
+    /* Initialize timers, loging system, the app scheduler and GPIOs. */
     timers_init();
     log_init();
+    APP_SCHED_INIT( SWITCH_SCHED_MAX_EVENT_SIZE, SWITCH_SCHED_QUEUE_SIZE );
     leds_buttons_init();
+#if SWITCH_PROFILING_ENABLED
+    switch_profile_init();
+#endif
  //   adc_configure();
 
     m_device_ctx.nwk_joined = ZB_FALSE;
@@ -1024,10 +3265,14 @@ int main(void)
     /* Set ZigBee stack logging level and traffic dump subsystem. */
     ZB_SET_TRACE_LEVEL( ZIGBEE_TRACE_LEVEL );
     ZB_SET_TRACE_MASK( ZIGBEE_TRACE_MASK );
+#if ZIGBEE_TRAF_DUMP_ENABLED
+    ZB_SET_TRAF_DUMP_ON();
+#else
     ZB_SET_TRAF_DUMP_OFF();
+#endif
 
     /* Initialize ZigBee stack. */
-    ZB_INIT("Hue Dimmer Switch (ZHA)");
+    ZB_INIT(SWITCH_PERSONALITY_NAME);
 
     /* Set device address to the value read from FICR registers. */
     zb_osif_get_ieee_eui64(ieee_addr);
@@ -1036,8 +3281,8 @@ int main(void)
     zb_set_network_ed_role( IEEE_CHANNEL_MASK );
     zigbee_erase_persistent_storage(ERASE_PERSISTENT_CONFIG);
 
-    zb_set_ed_timeout(ED_AGING_TIMEOUT_64MIN);
-    zb_set_keepalive_timeout(ZB_MILLISECONDS_TO_BEACON_INTERVAL(3000));
+    zb_set_ed_timeout(SWITCH_ED_AGING_TIMEOUT);
+    zb_set_keepalive_timeout(SWITCH_KEEPALIVE_TIMEOUT);
     //sleepy_device_setup();
     zb_set_rx_on_when_idle( RX_ON_IDLE );
     zb_set_node_descriptor_manufacturer_code( ZB_PHILIPS_MANUF_CODE );
@@ -1051,8 +3296,10 @@ int main(void)
     /* Register dimmer switch device context (endpoints). */
     ZB_AF_REGISTER_DEVICE_CTX(&dimmer_switch_ctx);
 
+#if SWITCH_ZHA_EP_ENABLED
     // Register zcl endpoint handlers to debug commands coming in
     ZB_AF_SET_ENDPOINT_HANDLER( LIGHT_SWITCH_ZHA_ENDPOINT, zb_zcl_handler_cb );
+#endif
  //   ZB_AF_SET_ENDPOINT_HANDLER( LIGHT_SWITCH_ZLL_ENDPOINT, zb_zcl_handler_cb );
     
     bulb_clusters_attr_init();
@@ -1063,18 +3310,35 @@ int main(void)
 
 
 
+    /* Battery estimator state and persistent attributes, kept across reboots. */
+    zb_nvram_register_app1_read_cb(switch_nvram_read_app_data);
+    zb_nvram_register_app1_write_cb(switch_nvram_write_app_data, switch_nvram_get_app_data_size);
+
     adc_configure();
+#if SWITCH_ZHA_EP_ENABLED
+    err_code = nrf_fstorage_init(&m_ota_fstorage, &nrf_fstorage_nvmc, NULL);
+    APP_ERROR_CHECK(err_code);
+#endif
     /** Start Zigbee Stack. */
     zb_err_code = zboss_start();
     ZB_ERROR_CHECK(zb_err_code);
 
     uint8_t zllReg = ZB_AF_IS_EP_REGISTERED( LIGHT_SWITCH_ZLL_ENDPOINT );
     uint8_t zhaReg = ZB_AF_IS_EP_REGISTERED( LIGHT_SWITCH_ZHA_ENDPOINT );
-    NRF_LOG_INFO( "ZLL Reg %d, ZHA Reg %d", zllReg, zhaReg );
+    NRF_LOG_INFO( "Build profile %d: ZLL Reg %d, ZHA Reg %d", SWITCH_BUILD_PROFILE, zllReg, zhaReg );
 
     while(1)
     {
         zboss_main_loop_iteration();
+        app_sched_execute();
+        if (m_device_ctx.battery.calibration_done)
+        {
+            battery_adc_calibration_complete( &m_device_ctx );
+        }
+        if (m_device_ctx.battery.result_ready || m_device_ctx.battery.loaded_result_ready)
+        {
+            battery_level_update( &m_device_ctx );
+        }
         UNUSED_RETURN_VALUE(NRF_LOG_PROCESS());
     }
 }
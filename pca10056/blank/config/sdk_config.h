@@ -99,6 +99,15 @@
 #define ZIGBEE_TRACE_MASK 0
 #endif
 
+// <q> ZIGBEE_TRAF_DUMP_ENABLED  - Dump 802.15.4 frames sent and received by the stack
+ 
+
+// <i> Enables the ZBOSS traffic dump. Every MAC frame is written to the trace output and can be converted to pcap (Wireshark, Zigbee dissector) with the ZBOSS dump converter. Requires a ZBOSS library built with traffic dump support.
+
+#ifndef ZIGBEE_TRAF_DUMP_ENABLED
+#define ZIGBEE_TRAF_DUMP_ENABLED 0
+#endif
+
 // <o> ZIGBEE_TIMER_INSTANCE_NO - nRF timer instance used by Zigbee stack 
 #ifndef ZIGBEE_TIMER_INSTANCE_NO
 #define ZIGBEE_TIMER_INSTANCE_NO 3
@@ -329,6 +338,13 @@
 
 // </e>
 
+// <e> NRFX_PPI_ENABLED - nrfx_ppi - PPI peripheral allocator
+//==========================================================
+#ifndef NRFX_PPI_ENABLED
+#define NRFX_PPI_ENABLED 1
+#endif
+// </e>
+
 // <e> NRFX_PRS_ENABLED - nrfx_prs - Peripheral Resource Sharing module
 //==========================================================
 #ifndef NRFX_PRS_ENABLED
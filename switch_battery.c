@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Battery capacity estimation and alarm thresholds of the light switch.
+ */
+
+#include "switch_battery.h"
+
+#include "nordic_common.h"
+#include "app_util.h"
+#include "nrf_log.h"
+
+/* Lithium manganese dioxide coin cell (CR2032/CR2450). Flat for most of the capacity, with a sharp knee. */
+static const battery_curve_point_t m_curve_li_coin[] =
+{
+    { 3000, 100 }, { 2900, 90 }, { 2800, 75 }, { 2700, 50 }, { 2600, 30 },
+    { 2500, 15 },  { 2400, 8 },  { 2200, 2 },  { 2000, 0 },
+};
+
+/* Lithium manganese dioxide cylindrical cell (CR2, CR123A). */
+static const battery_curve_point_t m_curve_li_cyl[] =
+{
+    { 3000, 100 }, { 2950, 90 }, { 2900, 75 }, { 2800, 50 }, { 2700, 25 },
+    { 2500, 5 },   { 2000, 0 },
+};
+
+/* Alkaline cell (AA, AAA, C, D). Close to linear over most of the capacity. */
+static const battery_curve_point_t m_curve_alkaline[] =
+{
+    { 1600, 100 }, { 1500, 90 }, { 1400, 70 }, { 1300, 45 }, { 1200, 25 },
+    { 1100, 10 },  { 1000, 3 },  { 900, 0 },
+};
+
+static const battery_model_t m_battery_model_li_coin  = { m_curve_li_coin,  ARRAY_SIZE(m_curve_li_coin),  15000, 620  };
+static const battery_model_t m_battery_model_li_cyl   = { m_curve_li_cyl,   ARRAY_SIZE(m_curve_li_cyl),   300,   1500 };
+static const battery_model_t m_battery_model_alkaline = { m_curve_alkaline, ARRAY_SIZE(m_curve_alkaline), 150,   2500 };
+
+const battery_model_t * battery_model_get(zb_uint8_t size)
+{
+    switch (size)
+    {
+        case ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AA:
+        case ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AAA:
+        case ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_C:
+        case ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_D:
+            return &m_battery_model_alkaline;
+
+        case ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_CR2:
+        case ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_CR123A:
+            return &m_battery_model_li_cyl;
+
+        default:
+            /* Built-in, other and unknown - the coin cell fitted to the switch. */
+            return &m_battery_model_li_coin;
+    }
+}
+
+zb_uint8_t battery_remaining_estimate(zb_uint16_t battery_mv, zb_uint32_t load_ua, zb_uint8_t size, zb_uint8_t quantity)
+{
+    const battery_model_t * p_model = battery_model_get(size);
+    zb_uint32_t             cell_mv;
+    zb_uint8_t              i;
+
+    quantity = MAX(quantity, 1);
+    cell_mv  = battery_mv / quantity;
+    cell_mv += ( load_ua * p_model->internal_resistance_mohm + 500000UL ) / 1000000UL;
+
+    if (cell_mv >= p_model->p_curve[0].mv)
+    {
+        return 2 * p_model->p_curve[0].percent;
+    }
+
+    for (i = 1; i < p_model->curve_len; i++)
+    {
+        const battery_curve_point_t * p_hi = &p_model->p_curve[i - 1];
+        const battery_curve_point_t * p_lo = &p_model->p_curve[i];
+
+        if (cell_mv >= p_lo->mv)
+        {
+            zb_uint32_t span_mv   = p_hi->mv - p_lo->mv;
+            zb_uint32_t span_half = 2 * ( p_hi->percent - p_lo->percent );
+
+            return (zb_uint8_t)( 2 * p_lo->percent +
+                                 ( ( cell_mv - p_lo->mv ) * span_half + span_mv / 2 ) / span_mv );
+        }
+    }
+
+    return 2 * p_model->p_curve[p_model->curve_len - 1].percent;
+}
+
+void battery_charge_account(battery_charge_t * p_charge)
+{
+    zb_time_t          now        = ZB_TIMER_GET();
+    zb_uint32_t        elapsed_ms = ZB_TIME_BEACON_INTERVAL_TO_MSEC( ZB_TIME_SUBTRACT( now, p_charge->accounted_at ) );
+    zb_uint32_t        charge_nc;
+
+    charge_nc  = elapsed_ms * BATTERY_SLEEP_CURRENT_UA;
+    charge_nc += p_charge->wakeups * BATTERY_WAKEUP_CHARGE_NC;
+    charge_nc += p_charge->tx_frames * BATTERY_TX_FRAME_CHARGE_NC;
+
+    p_charge->wakeups      = 0;
+    p_charge->tx_frames    = 0;
+    p_charge->accounted_at = now;
+
+    p_charge->used_frac_nc += charge_nc;
+    p_charge->used_uah     += p_charge->used_frac_nc / BATTERY_NC_PER_UAH;
+    p_charge->used_frac_nc %= BATTERY_NC_PER_UAH;
+}
+
+zb_uint8_t battery_observer_update(battery_charge_t * p_charge, zb_uint8_t size, zb_uint8_t measured)
+{
+    const battery_model_t * p_model    = battery_model_get(size);
+    zb_uint32_t             measured_q = (zb_uint32_t)measured << BATTERY_OBSERVER_FRAC_BITS;
+    zb_uint32_t             drawn_q;
+    zb_uint8_t              shift;
+
+    battery_charge_account(p_charge);
+
+    if (!p_charge->seeded ||
+        measured > ( p_charge->estimate_q >> BATTERY_OBSERVER_FRAC_BITS ) + BATTERY_OBSERVER_RESET)
+    {
+        NRF_LOG_INFO( "Battery estimator restarted at %d (0.5%%)", measured );
+        p_charge->used_uah     = 0;
+        p_charge->used_frac_nc = 0;
+        p_charge->observed_uah = 0;
+        p_charge->estimate_q   = measured_q;
+        p_charge->seeded       = ZB_TRUE;
+        p_charge->corrected_at = p_charge->accounted_at;
+        return measured;
+    }
+
+    /* Prediction from the charge drawn since the last step. */
+    drawn_q = (zb_uint32_t)( ( (zb_uint64_t)( p_charge->used_uah - p_charge->observed_uah ) *
+                               ( 200UL << BATTERY_OBSERVER_FRAC_BITS ) ) /
+                             ( p_model->capacity_mah * 1000UL ) );
+    p_charge->observed_uah = p_charge->used_uah;
+    p_charge->estimate_q   = ( drawn_q < p_charge->estimate_q ) ? p_charge->estimate_q - drawn_q : 0;
+
+    /* Correction from the voltage, once per measurement interval. */
+    if (ZB_TIME_SUBTRACT( p_charge->accounted_at, p_charge->corrected_at ) >= BATTERY_OBSERVER_MIN_STEP)
+    {
+        p_charge->corrected_at = p_charge->accounted_at;
+
+        shift = ( measured < BATTERY_OBSERVER_KNEE ) ? BATTERY_OBSERVER_KNEE_GAIN_SHIFT : BATTERY_OBSERVER_GAIN_SHIFT;
+        if (measured_q >= p_charge->estimate_q)
+        {
+            p_charge->estimate_q += ( measured_q - p_charge->estimate_q ) >> shift;
+        }
+        else
+        {
+            p_charge->estimate_q -= ( p_charge->estimate_q - measured_q ) >> shift;
+        }
+    }
+
+    return (zb_uint8_t)( ( p_charge->estimate_q + ( 1UL << ( BATTERY_OBSERVER_FRAC_BITS - 1 ) ) ) >> BATTERY_OBSERVER_FRAC_BITS );
+}
+
+zb_uint32_t battery_alarm_state_evaluate(const zb_uint8_t volt_thr[BATTERY_ALARM_LEVELS],
+                                         const zb_uint8_t pct_thr[BATTERY_ALARM_LEVELS],
+                                         zb_uint32_t old_state, zb_uint16_t battery_mv, zb_uint8_t remaining)
+{
+    zb_uint32_t new_state = old_state;
+    zb_uint8_t  level;
+
+    for (level = 0; level < BATTERY_ALARM_LEVELS; level++)
+    {
+        zb_uint32_t bit         = 1UL << level;
+        zb_bool_t   volt_active = ZB_FALSE;
+        zb_bool_t   pct_active  = ZB_FALSE;
+
+        if (volt_thr[level] != 0)
+        {
+            zb_uint16_t thr_mv = volt_thr[level] * 100;
+            volt_active = (old_state & bit) ? ( battery_mv < thr_mv + BATTERY_ALARM_HYSTERESIS_MV )
+                                            : ( battery_mv <= thr_mv );
+        }
+        if (pct_thr[level] != 0)
+        {
+            zb_uint16_t thr_half_pct = 2 * (zb_uint16_t)pct_thr[level];
+            pct_active = (old_state & bit) ? ( remaining < thr_half_pct + 2 * BATTERY_ALARM_HYSTERESIS_PCT )
+                                           : ( remaining <= thr_half_pct );
+        }
+
+        if (volt_active || pct_active)
+        {
+            new_state |= bit;
+        }
+        else
+        {
+            new_state &= ~bit;
+        }
+    }
+
+    return new_state;
+}
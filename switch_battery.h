@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Battery capacity estimation and alarm thresholds of the light switch.
+ *
+ * @details The switch measures its battery with the SAADC (see main.c). The functions here turn
+ *          the measured voltage into the BatteryPercentageRemaining value, fuse it with a coulomb
+ *          counter of the switch's own activity and evaluate the BatteryAlarmState bits. They do
+ *          not touch the ZCL attributes or the peripherals, so they can be built for the host.
+ */
+
+#ifndef SWITCH_BATTERY_H__
+#define SWITCH_BATTERY_H__
+
+#include "zboss_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATTERY_LEVEL_MEAS_INTERVAL     (300 * ZB_TIME_ONE_SECOND)              /**< Battery level measurement interval (beacon intervals). This value corresponds to 300 seconds (5 minutes). */
+
+/* Charge model of the switch's own activity, integrated by the coulomb counter. */
+#define BATTERY_SLEEP_CURRENT_UA        3                                       /**< Average current while sleeping, with RTC and RAM retention (uA). */
+#define BATTERY_WAKEUP_CHARGE_NC        36000                                   /**< Charge of a wakeup - CPU, data request TX and the RX window (nC, i.e. uA * ms). */
+#define BATTERY_TX_FRAME_CHARGE_NC      20000                                   /**< Charge of an application frame sent - TX and the MAC ACK (nC). */
+#define BATTERY_NC_PER_UAH              3600000UL                               /**< nC in one uAh. */
+#define BATTERY_OBSERVER_FRAC_BITS      16                                      /**< Fractional bits of the fused remaining capacity estimate. */
+#define BATTERY_OBSERVER_GAIN_SHIFT     10                                      /**< Weight of the voltage estimate (1/2^n per BATTERY_LEVEL_MEAS_INTERVAL) on the flat part of the curve. */
+#define BATTERY_OBSERVER_KNEE_GAIN_SHIFT 3                                      /**< Weight of the voltage estimate past the knee, where the voltage is informative. */
+#define BATTERY_OBSERVER_KNEE           40                                      /**< Voltage estimate (0.5% units) below which the knee gain is used. */
+#define BATTERY_OBSERVER_RESET          60                                      /**< Voltage estimate above the fused one (0.5% units) taken as a fresh battery. */
+#define BATTERY_OBSERVER_MIN_STEP       (BATTERY_LEVEL_MEAS_INTERVAL / 2)       /**< Shortest time between two voltage corrections, so the gains apply once per measurement interval. */
+
+#define BATTERY_ALARM_LEVELS            4                                       /**< Min threshold plus thresholds 1-3, in BatteryAlarmState bit order. */
+#define BATTERY_ALARM_HYSTERESIS_MV     50                                      /**< Voltage rise above a threshold needed to clear its alarm. */
+#define BATTERY_ALARM_HYSTERESIS_PCT    2                                       /**< Percentage rise (whole percent, like the thresholds) above a threshold needed to clear its alarm. */
+
+/* Open-circuit discharge curves, per cell, in descending voltage order. */
+typedef struct
+{
+    zb_uint16_t mv;
+    zb_uint8_t  percent;
+} battery_curve_point_t;
+
+typedef struct
+{
+    const battery_curve_point_t * p_curve;
+    zb_uint8_t                    curve_len;
+    zb_uint16_t                   internal_resistance_mohm; /**< Typical cell internal resistance, used to compensate the sag under the measurement load. */
+    zb_uint16_t                   capacity_mah;             /**< Typical capacity, used by the coulomb counter. */
+} battery_model_t;
+
+typedef struct battery_charge_s
+{
+  zb_uint32_t used_uah;                 /**< Charge drawn from the battery since it was fitted (uAh). */
+  zb_uint32_t used_frac_nc;             /**< Remainder of used_uah below 1 uAh (nC). */
+  zb_uint32_t observed_uah;             /**< used_uah at the last observer step. */
+  zb_uint32_t estimate_q;               /**< Fused remaining capacity in 0.5% units, with BATTERY_OBSERVER_FRAC_BITS fractional bits. */
+  zb_bool_t   seeded;                   /**< estimate_q holds a valid estimate, measured or restored from NVRAM. */
+  zb_uint8_t  persisted;                /**< Remaining capacity (0.5% units) last written to NVRAM. */
+  zb_uint32_t wakeups;                  /**< Wakeups since the last accounting. */
+  zb_uint32_t tx_frames;                /**< Application frames sent since the last accounting. */
+  zb_time_t   accounted_at;             /**< Time of the last accounting. */
+  zb_time_t   corrected_at;             /**< Time of the last voltage correction of estimate_q. */
+} battery_charge_t;
+
+/**@brief Function for selecting the battery model from the Power Config battery size attribute.
+ */
+const battery_model_t * battery_model_get(zb_uint8_t size);
+
+/**@brief Function for estimating the remaining battery capacity.
+ *
+ * @details The measured voltage is compensated for the drop across the cells' internal resistance
+ *          under the measurement load, divided between the cells in series and looked up in the
+ *          discharge curve of the battery chemistry with linear interpolation.
+ *
+ *          A cell that sags more than its typical internal resistance explains (an aged or cold cell)
+ *          is therefore reported lower, which is what makes the loaded measurement an early warning.
+ *
+ * @param[in] battery_mv   Battery voltage measured under load, in mV.
+ * @param[in] load_ua      Current drawn while the voltage was measured, in uA.
+ * @param[in] size         Value of the Power Config battery size attribute.
+ * @param[in] quantity     Value of the Power Config battery quantity attribute.
+ *
+ * @return Remaining capacity in 0.5% units (0 - 200), as used by the BatteryPercentageRemaining attribute.
+ */
+zb_uint8_t battery_remaining_estimate(zb_uint16_t battery_mv, zb_uint32_t load_ua, zb_uint8_t size, zb_uint8_t quantity);
+
+/**@brief Function for integrating the charge drawn from the battery since the last call.
+ *
+ * @details The switch does not measure its current, so the charge is modelled from its activity:
+ *          the sleep current over the elapsed time, plus a fixed charge per wakeup (each one
+ *          polls the parent) and per application frame sent.
+ */
+void battery_charge_account(battery_charge_t * p_charge);
+
+/**@brief Function for fusing the coulomb counter with the voltage based estimate.
+ *
+ * @details A fixed-point observer: the estimate is first moved down by the charge drawn since
+ *          the last step, relative to the typical battery capacity, and then towards the voltage
+ *          estimate by 1/2^BATTERY_OBSERVER_GAIN_SHIFT of the difference. On the flat part of
+ *          the discharge curve the coulomb counter therefore dominates; past the knee the voltage
+ *          is trusted more. A voltage estimate well above the fused one is taken as a fresh
+ *          battery and restarts the observer.
+ *
+ *          The gains are per measurement interval. A step less than BATTERY_OBSERVER_MIN_STEP
+ *          after the last correction only applies the charge drawn, so an extra call within the
+ *          same interval does not weigh the voltage twice.
+ *
+ * @param[inout] p_charge   Coulomb counter and observer state of the battery.
+ * @param[in]    size       Value of the Power Config battery size attribute.
+ * @param[in]    measured   Voltage based estimate, in 0.5% units.
+ *
+ * @return Fused remaining capacity, in 0.5% units.
+ */
+zb_uint8_t battery_observer_update(battery_charge_t * p_charge, zb_uint8_t size, zb_uint8_t measured);
+
+/**@brief Function for evaluating the battery alarm thresholds.
+ *
+ * @details A level is active when either its voltage or its percentage threshold is reached. A
+ *          threshold of 0 is disabled. An active level clears only once the value has risen by
+ *          the hysteresis above its threshold, so noise around a threshold does not toggle the
+ *          alarm. The percentage thresholds are in whole percent while BatteryPercentageRemaining
+ *          is in 0.5% units, so they are doubled before comparing.
+ *
+ * @param[in] volt_thr     Voltage thresholds in 100 mV units: min threshold, thresholds 1-3.
+ * @param[in] pct_thr      Percentage thresholds in whole percent, in the same order.
+ * @param[in] old_state    Current BatteryAlarmState.
+ * @param[in] battery_mv   Filtered idle battery voltage in mV.
+ * @param[in] remaining    BatteryPercentageRemaining value (0.5% units).
+ *
+ * @return New BatteryAlarmState. Bits above BATTERY_ALARM_LEVELS are kept from old_state.
+ */
+zb_uint32_t battery_alarm_state_evaluate(const zb_uint8_t volt_thr[BATTERY_ALARM_LEVELS],
+                                         const zb_uint8_t pct_thr[BATTERY_ALARM_LEVELS],
+                                         zb_uint32_t old_state, zb_uint16_t battery_mv, zb_uint8_t remaining);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SWITCH_BATTERY_H__
@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Green Power frames of a switch presenting itself as a Green Power device.
+ */
+
+#include "switch_gp.h"
+
+static zb_uint8_t * switch_gp_put16(zb_uint8_t * p_data, zb_uint16_t value)
+{
+    *p_data++ = (zb_uint8_t)value;
+    *p_data++ = (zb_uint8_t)(value >> 8);
+    return p_data;
+}
+
+static zb_uint8_t * switch_gp_put32(zb_uint8_t * p_data, zb_uint32_t value)
+{
+    p_data = switch_gp_put16(p_data, (zb_uint16_t)value);
+    return switch_gp_put16(p_data, (zb_uint16_t)(value >> 16));
+}
+
+zb_uint8_t switch_gp_notification_put(zb_uint8_t * p_data, zb_uint32_t src_id, zb_uint32_t frame_counter,
+                                      zb_uint8_t gpd_cmd_id)
+{
+    zb_uint8_t * p_end;
+
+    /* ApplicationID 0 (SrcID), no security, no proxy info. */
+    p_end    = switch_gp_put16(p_data, SWITCH_GP_NOTIFICATION_OPT_ALSO_UNICAST);
+    p_end    = switch_gp_put32(p_end, src_id);
+    p_end    = switch_gp_put32(p_end, frame_counter);
+    *p_end++ = gpd_cmd_id;
+    *p_end++ = 0;                       /* Length of the GPD command payload. */
+
+    return (zb_uint8_t)(p_end - p_data);
+}
+
+zb_uint8_t switch_gp_commissioning_put(zb_uint8_t * p_data, zb_uint32_t src_id, zb_uint32_t frame_counter,
+                                       zb_uint8_t device_id)
+{
+    zb_uint8_t * p_end;
+
+    /* ApplicationID 0 (SrcID), no security, no proxy info. */
+    p_end    = switch_gp_put16(p_data, 0x0000);
+    p_end    = switch_gp_put32(p_end, src_id);
+    p_end    = switch_gp_put32(p_end, frame_counter);
+    *p_end++ = SWITCH_GPD_CMD_COMMISSIONING;
+    *p_end++ = 2;                       /* Length of the GPD command payload. */
+    *p_end++ = device_id;
+    *p_end++ = 0x00;                    /* GPD options: no MAC sequence number, not receiving, no keys. */
+
+    return (zb_uint8_t)(p_end - p_data);
+}
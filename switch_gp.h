@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Green Power frames of a switch presenting itself as a Green Power device.
+ *
+ * @details A Green Power device (GPD) like the Hue Tap sends its commands in GPD frames, which a
+ *          Green Power proxy forwards to the sink - the bridge - as GP Notification commands of
+ *          the Green Power cluster. The switch cannot send GPD frames through the stack, so it
+ *          acts as its own proxy and sends the GP Notification directly, as the bridge would
+ *          receive it from a proxy. The payloads follow the Green Power specification
+ *          (A.3.3.4.1 GP Notification, A.3.3.4.3 GP Commissioning Notification), for the
+ *          GPD SrcID application and without security. All fields are little endian.
+ */
+
+#ifndef SWITCH_GP_H__
+#define SWITCH_GP_H__
+
+#include "zboss_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SWITCH_GP_ENDPOINT                      242                             /**< Green Power endpoint, source and destination of the proxy commands. */
+#define SWITCH_GP_PROFILE_ID                    0xA1E0
+#define SWITCH_GP_CLUSTER_ID                    0x0021
+#define SWITCH_GP_CMD_NOTIFICATION              0x00                            /**< GP Notification, a GPD command forwarded to the sink. */
+#define SWITCH_GP_CMD_COMMISSIONING_NOTIFICATION 0x04                           /**< GP Commissioning Notification, a GPD commissioning command forwarded to the sink. */
+
+#define SWITCH_GP_NOTIFICATION_OPT_ALSO_UNICAST 0x0008                          /**< GP Notification options: the sink is reached by unicast. */
+
+#define SWITCH_GPD_CMD_COMMISSIONING            0xE0
+#define SWITCH_GPD_DEVICE_ID_ON_OFF_SWITCH      0x02
+
+#define SWITCH_GP_NOTIFICATION_MAX_SIZE         16                              /**< Largest payload built by the functions below. */
+
+/**@brief Function for building the payload of a GP Notification carrying a GPD command without payload.
+ *
+ * @param[out]  p_data          Buffer of at least SWITCH_GP_NOTIFICATION_MAX_SIZE bytes.
+ * @param[in]   src_id          GPD SrcID of the switch.
+ * @param[in]   frame_counter   GPD frame counter of the command.
+ * @param[in]   gpd_cmd_id      GPD command.
+ *
+ * @return Length of the payload.
+ */
+zb_uint8_t switch_gp_notification_put(zb_uint8_t * p_data, zb_uint32_t src_id, zb_uint32_t frame_counter,
+                                      zb_uint8_t gpd_cmd_id);
+
+/**@brief Function for building the payload of a GP Commissioning Notification carrying a GPD Commissioning command.
+ *
+ * @param[out]  p_data          Buffer of at least SWITCH_GP_NOTIFICATION_MAX_SIZE bytes.
+ * @param[in]   src_id          GPD SrcID of the switch.
+ * @param[in]   frame_counter   GPD frame counter of the command.
+ * @param[in]   device_id       GPD device ID announced to the sink.
+ *
+ * @return Length of the payload.
+ */
+zb_uint8_t switch_gp_commissioning_put(zb_uint8_t * p_data, zb_uint32_t src_id, zb_uint32_t frame_counter,
+                                       zb_uint8_t device_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SWITCH_GP_H__
@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Application dataset of the light switch in the Zigbee NVRAM.
+ */
+
+#include "switch_nvram.h"
+
+#include "nordic_common.h"
+#include "nrf_log.h"
+
+zb_uint16_t switch_nvram_dataset_read(zb_uint8_t page, zb_uint32_t pos, zb_uint16_t payload_length,
+                                      void * p_data, zb_uint16_t data_size, zb_uint16_t version)
+{
+    const switch_nvram_header_t * p_header = (const switch_nvram_header_t *)p_data;
+    zb_ret_t                      ret;
+    zb_uint16_t                   length;
+
+    if (payload_length < sizeof(switch_nvram_header_t))
+    {
+        NRF_LOG_WARNING( "Ignoring application NVRAM data of %d bytes", payload_length );
+        return 0;
+    }
+
+    length = MIN( payload_length, data_size );
+    ret    = zb_osif_nvram_read(page, pos, (zb_uint8_t *)p_data, length);
+    if (ret != RET_OK)
+    {
+        NRF_LOG_WARNING( "Application NVRAM read failed, status %d", ret );
+        ZB_BZERO( p_data, data_size );
+        return 0;
+    }
+
+    if ((p_header->version != version) || (p_header->length != payload_length))
+    {
+        NRF_LOG_WARNING( "Ignoring application NVRAM data version %d of %d bytes",
+                         p_header->version, p_header->length );
+        ZB_BZERO( p_data, data_size );
+        return 0;
+    }
+
+    if (length != data_size)
+    {
+        NRF_LOG_INFO( "Restored %d of %d bytes of application NVRAM data", length, data_size );
+    }
+
+    return length;
+}
+
+const switch_persistent_attr_t * switch_nvram_attr_find(const switch_persistent_attr_t * p_attrs, zb_uint8_t count,
+                                                        zb_uint8_t endpoint, zb_uint16_t cluster_id, zb_uint16_t attr_id)
+{
+    for (zb_uint8_t i = 0; i < count; i++)
+    {
+        if (p_attrs[i].endpoint == endpoint &&
+            p_attrs[i].cluster_id == cluster_id &&
+            p_attrs[i].attr_id == attr_id)
+        {
+            return &p_attrs[i];
+        }
+    }
+
+    return NULL;
+}
+
+void switch_nvram_attrs_restore(const switch_persistent_attr_t * p_attrs, zb_uint8_t count,
+                                const void * p_data, zb_uint16_t length)
+{
+    for (zb_uint8_t i = 0; i < count; i++)
+    {
+        if (p_attrs[i].offset + p_attrs[i].size <= length)
+        {
+            ZB_MEMCPY( p_attrs[i].p_value, (const zb_uint8_t *)p_data + p_attrs[i].offset, p_attrs[i].size );
+        }
+    }
+}
+
+void switch_nvram_attrs_store(const switch_persistent_attr_t * p_attrs, zb_uint8_t count, void * p_data)
+{
+    for (zb_uint8_t i = 0; i < count; i++)
+    {
+        ZB_MEMCPY( (zb_uint8_t *)p_data + p_attrs[i].offset, p_attrs[i].p_value, p_attrs[i].size );
+    }
+}
+
+zb_bool_t switch_nvram_attrs_changed(const switch_persistent_attr_t * p_attrs, zb_uint8_t count, const void * p_data)
+{
+    for (zb_uint8_t i = 0; i < count; i++)
+    {
+        if (ZB_MEMCMP( (const zb_uint8_t *)p_data + p_attrs[i].offset, p_attrs[i].p_value, p_attrs[i].size ))
+        {
+            return ZB_TRUE;
+        }
+    }
+
+    return ZB_FALSE;
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Application dataset of the light switch in the Zigbee NVRAM.
+ *
+ * @details The dataset (ZB_NVRAM_APP_DATA1) starts with a switch_nvram_header_t and is followed
+ *          by the fields of the firmware that wrote it. Fields are only ever appended, so a
+ *          dataset written by another firmware version is restored up to the fields both know.
+ *          Writable attributes kept across reboots are described by a table of
+ *          switch_persistent_attr_t, mapping each attribute to its field of the dataset.
+ */
+
+#ifndef SWITCH_NVRAM_H__
+#define SWITCH_NVRAM_H__
+
+#include "zboss_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef ZB_PACKED_PRE struct switch_nvram_header_s
+{
+    zb_uint16_t version;                /**< Dataset version of the firmware that wrote the dataset. */
+    zb_uint16_t length;                 /**< Size of the dataset as written, header included. */
+} ZB_PACKED_STRUCT switch_nvram_header_t;
+
+/* Writable attributes kept across reboots, in the application NVRAM dataset. */
+typedef struct
+{
+    zb_uint8_t  endpoint;
+    zb_uint16_t cluster_id;
+    zb_uint16_t attr_id;
+    void      * p_value;                /**< Attribute storage. */
+    zb_uint8_t  offset;                 /**< Offset of the value in the dataset. */
+    zb_uint8_t  size;                   /**< Size of the ZCL value, including the length byte of strings. */
+} switch_persistent_attr_t;
+
+#define SWITCH_NVRAM_ATTR( data_type, endpoint, cluster_id, attr_id, p_value, field )          \
+    { endpoint, cluster_id, attr_id, p_value,                                                   \
+      offsetof(data_type, field), sizeof(((data_type *)0)->field) }
+
+/**@brief Function for reading the application dataset.
+ *
+ * @details Only the fields this firmware knows are read, a longer dataset was written by a newer
+ *          one. The dataset is rejected if it is shorter than its header, was written with another
+ *          version, or its header does not match the payload length stored by the stack.
+ *
+ * @param[in]  page             NVRAM page, as passed to the read callback.
+ * @param[in]  pos              Position of the dataset in the page.
+ * @param[in]  payload_length   Size of the dataset as stored by the stack.
+ * @param[out] p_data           Dataset of this firmware, starting with a switch_nvram_header_t.
+ *                              Zeroed if the dataset is rejected.
+ * @param[in]  data_size        Size of the dataset of this firmware.
+ * @param[in]  version          Dataset version of this firmware.
+ *
+ * @return Bytes of p_data restored, 0 if the dataset was rejected.
+ */
+zb_uint16_t switch_nvram_dataset_read(zb_uint8_t page, zb_uint32_t pos, zb_uint16_t payload_length,
+                                      void * p_data, zb_uint16_t data_size, zb_uint16_t version);
+
+/**@brief Function for finding a persistent attribute.
+ *
+ * @return The attribute, or NULL if it is not persistent.
+ */
+const switch_persistent_attr_t * switch_nvram_attr_find(const switch_persistent_attr_t * p_attrs, zb_uint8_t count,
+                                                        zb_uint8_t endpoint, zb_uint16_t cluster_id, zb_uint16_t attr_id);
+
+/**@brief Function for restoring the persistent attributes from a dataset.
+ *
+ * @details Attributes missing from a shorter dataset keep their current value.
+ *
+ * @param[in] p_data   Dataset as read.
+ * @param[in] length   Bytes of p_data restored, see switch_nvram_dataset_read.
+ */
+void switch_nvram_attrs_restore(const switch_persistent_attr_t * p_attrs, zb_uint8_t count,
+                                const void * p_data, zb_uint16_t length);
+
+/**@brief Function for copying the persistent attributes into a dataset.
+ */
+void switch_nvram_attrs_store(const switch_persistent_attr_t * p_attrs, zb_uint8_t count, void * p_data);
+
+/**@brief Function for checking whether a persistent attribute differs from the dataset.
+ */
+zb_bool_t switch_nvram_attrs_changed(const switch_persistent_attr_t * p_attrs, zb_uint8_t count, const void * p_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SWITCH_NVRAM_H__
@@ -0,0 +1,277 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Decoder of delta OTA images, building the full OTA file from the running image.
+ */
+
+#include "switch_ota_delta.h"
+
+#include "nordic_common.h"
+#include "nrf_log.h"
+
+void switch_ota_delta_init(switch_ota_delta_t * p_delta, const zb_uint8_t * p_running, zb_uint32_t running_size,
+                           zb_uint32_t running_version, zb_uint32_t image_length_min, zb_uint32_t image_length_max)
+{
+    ZB_BZERO( p_delta, sizeof(*p_delta) );
+    p_delta->p_running        = p_running;
+    p_delta->running_size     = running_size;
+    p_delta->running_version  = running_version;
+    p_delta->image_length_min = image_length_min;
+    p_delta->image_length_max = image_length_max;
+    p_delta->state            = SWITCH_OTA_DELTA_OTA_HEADER;
+}
+
+void switch_ota_delta_input(switch_ota_delta_t * p_delta, const zb_uint8_t * p_data, zb_uint16_t len)
+{
+    p_delta->p_input   = p_data;
+    p_delta->input_len = len;
+}
+
+/**@brief Function for handing part of the OTA file out.
+ */
+static zb_bool_t switch_ota_delta_emit(switch_ota_delta_t * p_delta, const zb_uint8_t * p_data, zb_uint16_t len,
+                                       const zb_uint8_t ** pp_out, zb_uint16_t * p_out_len)
+{
+    if (p_delta->produced + len > p_delta->image_length)
+    {
+        NRF_LOG_WARNING( "OTA patch overruns the image" );
+        return ZB_FALSE;
+    }
+
+    *pp_out             = p_data;
+    *p_out_len          = len;
+    p_delta->produced  += len;
+    return ZB_TRUE;
+}
+
+/**@brief Function for collecting the fixed size fields of a header or command.
+ *
+ * @return ZB_TRUE once all size bytes are in fields. Fields split across blocks are completed
+ *         with the next block.
+ */
+static zb_bool_t switch_ota_delta_take(switch_ota_delta_t * p_delta, zb_uint8_t size)
+{
+    zb_uint8_t chunk;
+
+    if (p_delta->fields_len >= size)
+    {
+        return ZB_TRUE;
+    }
+    chunk = MIN(p_delta->input_len, size - p_delta->fields_len);
+
+    ZB_MEMCPY( &p_delta->fields[p_delta->fields_len], p_delta->p_input, chunk );
+    p_delta->fields_len += chunk;
+    p_delta->p_input    += chunk;
+    p_delta->input_len  -= chunk;
+
+    return (p_delta->fields_len == size) ? ZB_TRUE : ZB_FALSE;
+}
+
+zb_bool_t switch_ota_delta_decode(switch_ota_delta_t * p_delta, const zb_uint8_t ** pp_out, zb_uint16_t * p_out_len)
+{
+    *p_out_len = 0;
+
+    while (p_delta->input_len > 0 && *p_out_len == 0)
+    {
+        zb_bool_t  in_patch = (p_delta->state >= SWITCH_OTA_DELTA_PATCH_HEADER &&
+                               p_delta->state <= SWITCH_OTA_DELTA_INSERT) ? ZB_TRUE : ZB_FALSE;
+        zb_uint16_t before;
+        zb_uint16_t chunk;
+
+        if (in_patch && p_delta->input_len > p_delta->patch_len)
+        {
+            /* Tags after the patch are not used. */
+            p_delta->input_len = p_delta->patch_len;
+        }
+        before = p_delta->input_len;
+
+        switch (p_delta->state)
+        {
+            case SWITCH_OTA_DELTA_OTA_HEADER:
+                if (switch_ota_delta_take(p_delta, 8))
+                {
+                    zb_uint16_t header_length;
+
+                    ZB_LETOH16( &header_length, &p_delta->fields[6] );
+                    if (header_length < 8)
+                    {
+                        NRF_LOG_WARNING( "OTA delta image header of %u bytes", header_length );
+                        return ZB_FALSE;
+                    }
+                    p_delta->skip       = header_length - 8;
+                    p_delta->fields_len = 0;
+                    p_delta->state      = SWITCH_OTA_DELTA_OTA_HEADER_SKIP;
+                }
+                break;
+
+            case SWITCH_OTA_DELTA_OTA_HEADER_SKIP:
+                chunk = MIN(p_delta->input_len, p_delta->skip);
+                p_delta->p_input   += chunk;
+                p_delta->input_len -= chunk;
+                p_delta->skip      -= chunk;
+                if (p_delta->skip == 0)
+                {
+                    p_delta->state = SWITCH_OTA_DELTA_TAG;
+                }
+                break;
+
+            case SWITCH_OTA_DELTA_TAG:
+                if (switch_ota_delta_take(p_delta, 6))
+                {
+                    zb_uint16_t tag_id;
+
+                    ZB_LETOH16( &tag_id, &p_delta->fields[0] );
+                    ZB_LETOH32( &p_delta->patch_len, &p_delta->fields[2] );
+                    if (tag_id != SWITCH_OTA_TAG_DELTA_PATCH)
+                    {
+                        NRF_LOG_WARNING( "OTA delta image without a patch, tag 0x%04x", tag_id );
+                        return ZB_FALSE;
+                    }
+                    p_delta->fields_len = 0;
+                    p_delta->state      = SWITCH_OTA_DELTA_PATCH_HEADER;
+                }
+                break;
+
+            case SWITCH_OTA_DELTA_PATCH_HEADER:
+                if (switch_ota_delta_take(p_delta, 8))
+                {
+                    zb_uint32_t base_version;
+
+                    ZB_LETOH32( &base_version, &p_delta->fields[0] );
+                    ZB_LETOH32( &p_delta->image_length, &p_delta->fields[4] );
+                    if (base_version != p_delta->running_version ||
+                        p_delta->image_length > p_delta->image_length_max ||
+                        p_delta->image_length < p_delta->image_length_min)
+                    {
+                        NRF_LOG_WARNING( "OTA patch for 0x%08x, %u bytes, does not apply", base_version, p_delta->image_length );
+                        return ZB_FALSE;
+                    }
+                    p_delta->fields_len = 0;
+                    p_delta->state      = SWITCH_OTA_DELTA_COMMAND;
+                }
+                break;
+
+            case SWITCH_OTA_DELTA_COMMAND:
+                if (!switch_ota_delta_take(p_delta, 1))
+                {
+                    break;
+                }
+                if (p_delta->fields[0] == SWITCH_OTA_DELTA_OP_COPY)
+                {
+                    zb_uint32_t src;
+                    zb_uint16_t len;
+
+                    if (!switch_ota_delta_take(p_delta, 7))
+                    {
+                        break;
+                    }
+                    ZB_LETOH32( &src, &p_delta->fields[1] );
+                    ZB_LETOH16( &len, &p_delta->fields[5] );
+                    p_delta->fields_len = 0;
+                    if (src > p_delta->running_size || len > p_delta->running_size - src ||
+                        !switch_ota_delta_emit(p_delta, p_delta->p_running + src, len, pp_out, p_out_len))
+                    {
+                        NRF_LOG_WARNING( "OTA patch copies %u bytes from %u", len, src );
+                        return ZB_FALSE;
+                    }
+                }
+                else if (p_delta->fields[0] == SWITCH_OTA_DELTA_OP_INSERT)
+                {
+                    if (!switch_ota_delta_take(p_delta, 3))
+                    {
+                        break;
+                    }
+                    ZB_LETOH16( &p_delta->insert, &p_delta->fields[1] );
+                    p_delta->fields_len = 0;
+                    if (p_delta->insert > 0)
+                    {
+                        p_delta->state = SWITCH_OTA_DELTA_INSERT;
+                    }
+                }
+                else
+                {
+                    NRF_LOG_WARNING( "OTA patch command 0x%02x unknown", p_delta->fields[0] );
+                    return ZB_FALSE;
+                }
+                break;
+
+            case SWITCH_OTA_DELTA_INSERT:
+                chunk = MIN(p_delta->input_len, p_delta->insert);
+                if (!switch_ota_delta_emit(p_delta, p_delta->p_input, chunk, pp_out, p_out_len))
+                {
+                    return ZB_FALSE;
+                }
+                p_delta->p_input   += chunk;
+                p_delta->input_len -= chunk;
+                p_delta->insert    -= chunk;
+                if (p_delta->insert == 0)
+                {
+                    p_delta->state = SWITCH_OTA_DELTA_COMMAND;
+                }
+                break;
+
+            default:
+                p_delta->input_len = 0;
+                break;
+        }
+
+        if (in_patch)
+        {
+            p_delta->patch_len -= before - p_delta->input_len;
+            if (p_delta->patch_len == 0)
+            {
+                if (p_delta->state != SWITCH_OTA_DELTA_COMMAND || p_delta->fields_len != 0)
+                {
+                    NRF_LOG_WARNING( "OTA patch truncated" );
+                    return ZB_FALSE;
+                }
+                p_delta->state = SWITCH_OTA_DELTA_DONE;
+            }
+        }
+    }
+
+    return ZB_TRUE;
+}
+
+zb_bool_t switch_ota_delta_complete(const switch_ota_delta_t * p_delta)
+{
+    return (p_delta->state == SWITCH_OTA_DELTA_DONE && p_delta->produced == p_delta->image_length) ? ZB_TRUE : ZB_FALSE;
+}
@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Decoder of delta OTA images, building the full OTA file from the running image.
+ *
+ * @details The OTA file header of a delta image is followed by a patch tag building the full OTA
+ *          file of the new version, SHA-256 tag included, from the running image:
+ *            tag header     tag ID SWITCH_OTA_TAG_DELTA_PATCH (2), patch length (4)
+ *            patch header   file version of the running image (4), length of the full OTA file (4)
+ *            COPY   0x01    offset in the running image (4), length (2)
+ *            INSERT 0x02    length (2), followed by the bytes
+ *          All fields are little endian. Any tag after the patch is ignored. Delta images are
+ *          made with tools/make_ota_delta.py.
+ *
+ *          The image is decoded as it arrives, block by block. COPY commands hand the running
+ *          image out directly from flash and INSERT commands the bytes in the block, so the
+ *          patch is never buffered.
+ */
+
+#ifndef SWITCH_OTA_DELTA_H__
+#define SWITCH_OTA_DELTA_H__
+
+#include "zboss_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SWITCH_OTA_TAG_DELTA_PATCH      0xF001                                  /**< Manufacturer-specific tag holding the patch. */
+#define SWITCH_OTA_DELTA_OP_COPY        0x01
+#define SWITCH_OTA_DELTA_OP_INSERT      0x02
+#define SWITCH_OTA_DELTA_FIELDS_SIZE    8                                       /**< Largest of the tag header, the patch header and the commands. */
+
+typedef enum
+{
+    SWITCH_OTA_DELTA_OTA_HEADER,        /**< Reading the start of the OTA file header, up to its length. */
+    SWITCH_OTA_DELTA_OTA_HEADER_SKIP,   /**< Skipping the rest of the header. */
+    SWITCH_OTA_DELTA_TAG,
+    SWITCH_OTA_DELTA_PATCH_HEADER,
+    SWITCH_OTA_DELTA_COMMAND,
+    SWITCH_OTA_DELTA_INSERT,            /**< Passing the bytes of an INSERT command on. */
+    SWITCH_OTA_DELTA_DONE,
+} switch_ota_delta_state_t;
+
+typedef struct
+{
+    const zb_uint8_t * p_running;       /**< Running image, the source of the COPY commands. */
+    zb_uint32_t        running_size;
+    zb_uint32_t        running_version; /**< File version the patch must be built against. */
+    zb_uint32_t        image_length_min;
+    zb_uint32_t        image_length_max;
+    switch_ota_delta_state_t state;
+    zb_uint8_t         fields[SWITCH_OTA_DELTA_FIELDS_SIZE]; /**< Fields of the header or command being parsed. */
+    zb_uint8_t         fields_len;
+    zb_uint32_t        skip;            /**< Bytes of the OTA file header still to skip. */
+    zb_uint32_t        patch_len;       /**< Bytes of the patch still to parse. */
+    zb_uint16_t        insert;          /**< Bytes of the current INSERT command still to come. */
+    zb_uint32_t        image_length;    /**< Size of the OTA file the patch builds, from the patch header. */
+    zb_uint32_t        produced;        /**< Bytes of the OTA file built so far. */
+    const zb_uint8_t * p_input;         /**< Part of the current block not yet parsed. */
+    zb_uint16_t        input_len;
+} switch_ota_delta_t;
+
+/**@brief Function for preparing the decoding of a delta image.
+ *
+ * @param[out] p_delta            Decoder.
+ * @param[in]  p_running          Running image.
+ * @param[in]  running_size       Size of the running image - COPY commands beyond it are rejected.
+ * @param[in]  running_version    File version of the running image.
+ * @param[in]  image_length_min   Smallest OTA file the patch may build.
+ * @param[in]  image_length_max   Largest OTA file the patch may build.
+ */
+void switch_ota_delta_init(switch_ota_delta_t * p_delta, const zb_uint8_t * p_running, zb_uint32_t running_size,
+                           zb_uint32_t running_version, zb_uint32_t image_length_min, zb_uint32_t image_length_max);
+
+/**@brief Function for handing the next block of the delta image to the decoder.
+ *
+ * @details The block must stay valid until switch_ota_delta_decode has used it up.
+ */
+void switch_ota_delta_input(switch_ota_delta_t * p_delta, const zb_uint8_t * p_data, zb_uint16_t len);
+
+/**@brief Function for parsing the delta image until it yields part of the OTA file, or the block is used up.
+ *
+ * @param[inout] p_delta     Decoder.
+ * @param[out]   pp_out      Part of the OTA file, in the running image or the block.
+ * @param[out]   p_out_len   Length of the part, 0 once the block is used up.
+ *
+ * @return ZB_FALSE if the patch is malformed or does not apply to the running image.
+ */
+zb_bool_t switch_ota_delta_decode(switch_ota_delta_t * p_delta, const zb_uint8_t ** pp_out, zb_uint16_t * p_out_len);
+
+/**@brief Function for checking that the patch was parsed to its end and built the whole OTA file.
+ */
+zb_bool_t switch_ota_delta_complete(const switch_ota_delta_t * p_delta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SWITCH_OTA_DELTA_H__
@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Hue device models the switch can present itself as.
+ *
+ * The personality fixes everything the bridge uses to recognize the device: the Basic model id,
+ * the endpoint device ids, the buttons and the button event format - FC00 button events, or GP
+ * Notifications for the Green Power Tap. It is selected at
+ * compile time, e.g. CFLAGS += -DSWITCH_PERSONALITY=SWITCH_PERSONALITY_ROM001, so the button
+ * path carries no checks for the model.
+ */
+
+#ifndef SWITCH_PERSONALITY_H__
+#define SWITCH_PERSONALITY_H__
+
+#define SWITCH_PERSONALITY_RWL021           0                                   /**< Hue Dimmer Switch - four buttons, press/hold/release events. */
+#define SWITCH_PERSONALITY_ROM001           1                                   /**< Hue Smart Button - one button, press/hold/release events. */
+#define SWITCH_PERSONALITY_TAP              2                                   /**< Hue Tap - four buttons, one Green Power command per press. */
+
+#ifndef SWITCH_PERSONALITY
+#define SWITCH_PERSONALITY                  SWITCH_PERSONALITY_RWL021
+#endif
+
+/**@brief Payload of the manufacturer specific button event command (cluster 0xFC00, command 0x00).
+ *
+ * @details Little endian: button number, two zero bytes, 0x30, transition type, 0x21 and the
+ *          event duration in 100 ms units - e.g. 01 00 00 30 00 21 00 00 for button 1 pressed.
+ */
+#define SWITCH_HUE_EVENT_DATA( buttonCode, transitionType, eventTime )                         \
+    ( ( (zb_uint64_t)(buttonCode) )             | ( (zb_uint64_t)0x30 << 24 ) |                  \
+      ( (zb_uint64_t)(transitionType) << 32 )   | ( (zb_uint64_t)0x21 << 40 ) |                  \
+      ( (zb_uint64_t)(eventTime) << 48 ) )
+
+/**@brief GPD command sent by the Hue Tap for a button: 0x22, 0x10, 0x11 and 0x12 for buttons 1-4.
+ */
+#define SWITCH_HUE_TAP_GPD_CMD( buttonId )  (zb_uint8_t)( ( (buttonId) == 0 ) ? 0x22 : 0x0F + (buttonId) )
+
+#if SWITCH_PERSONALITY == SWITCH_PERSONALITY_RWL021
+
+#define SWITCH_PERSONALITY_NAME             "Hue Dimmer Switch (ZHA)"
+#define SWITCH_PERSONALITY_MODEL_ID         "RWL021"
+#define ZB_HA_HUE_ZLL_DEVICE_ID             0x0830                              /**< ZLL Non-color scene controller. */
+#define SWITCH_PERSONALITY_BUTTON_COUNT     4
+#define SWITCH_PERSONALITY_HOLD_EVENTS      1                                   /**< Holds are repeated and the release is reported. */
+#define SWITCH_PERSONALITY_GREEN_POWER      0                                   /**< Button events are FC00 commands of the ZHA endpoint. */
+/* On, Up, Down, Off are reported as buttons 1-4. */
+#define SWITCH_PERSONALITY_EVENT_DATA( buttonId, transitionType, eventTime )                   \
+    SWITCH_HUE_EVENT_DATA( (buttonId) + 1, transitionType, eventTime )
+
+#elif SWITCH_PERSONALITY == SWITCH_PERSONALITY_ROM001
+
+#define SWITCH_PERSONALITY_NAME             "Hue Smart Button (ZHA)"
+#define SWITCH_PERSONALITY_MODEL_ID         "ROM001"
+#define ZB_HA_HUE_ZLL_DEVICE_ID             0x0820                              /**< ZLL Non-color controller. */
+#define SWITCH_PERSONALITY_BUTTON_COUNT     1
+#define SWITCH_PERSONALITY_HOLD_EVENTS      1
+#define SWITCH_PERSONALITY_GREEN_POWER      0
+#define SWITCH_PERSONALITY_EVENT_DATA( buttonId, transitionType, eventTime )                   \
+    SWITCH_HUE_EVENT_DATA( (buttonId) + 1, transitionType, eventTime )
+
+#elif SWITCH_PERSONALITY == SWITCH_PERSONALITY_TAP
+
+#define SWITCH_PERSONALITY_NAME             "Hue Tap (ZHA)"
+#define SWITCH_PERSONALITY_MODEL_ID         "ZGPSWITCH"
+#define ZB_HA_HUE_ZLL_DEVICE_ID             0x0830                              /**< ZLL Non-color scene controller. */
+#define SWITCH_PERSONALITY_BUTTON_COUNT     4
+#define SWITCH_PERSONALITY_HOLD_EVENTS      0                                   /**< Only the press is reported, as by the Tap. */
+#define SWITCH_PERSONALITY_GREEN_POWER      1                                   /**< Button events are GP Notifications, see switch_gp.h. */
+#define SWITCH_PERSONALITY_GPD_CMD( buttonId ) SWITCH_HUE_TAP_GPD_CMD( buttonId )
+
+#else
+#error Unknown SWITCH_PERSONALITY.
+#endif
+
+#endif // SWITCH_PERSONALITY_H__
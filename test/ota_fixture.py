@@ -0,0 +1,52 @@
+"""Write the running image and the full OTA file of the delta OTA round trip test.
+
+    python3 ota_fixture.py running.bin new.ota
+
+The running image is pseudo-random, so only what the new image really shares with it can be
+copied. The new image changes bytes here and there, inserts, drops and moves blocks, and is
+wrapped into an OTA file closed by the SHA-256 tag, like the ones the switch downloads.
+"""
+
+import hashlib
+import random
+import struct
+import sys
+
+RUNNING_SIZE = 96 * 1024
+NEW_FILE_VERSION = 0x01020400
+MANUFACTURER_CODE = 0x100B
+TAG_UPGRADE_IMAGE = 0x0000
+TAG_SHA256 = 0xF000
+
+
+def ota_file(image, file_version):
+    header_length = 56
+    upgrade_tag = struct.pack('<HI', TAG_UPGRADE_IMAGE, len(image)) + image
+    total_size = header_length + len(upgrade_tag) + 6 + 32
+    header = struct.pack('<IHHHHHIH32sI', 0x0BEEF11E, 0x0100, header_length, 0, MANUFACTURER_CODE, 0x0000,
+                         file_version, 0x0002, b'light switch round trip test'.ljust(32, b'\0'), total_size)
+    body = header + upgrade_tag
+    return body + struct.pack('<HI', TAG_SHA256, 32) + hashlib.sha256(body).digest()
+
+
+def main():
+    rng = random.Random(0x5EED)
+    running = bytes(rng.getrandbits(8) for _ in range(RUNNING_SIZE))
+
+    new = bytearray(running)
+    for _ in range(200):
+        new[rng.randrange(len(new))] = rng.getrandbits(8)
+    new[20000:20000] = bytes(rng.getrandbits(8) for _ in range(700))
+    del new[50000:51500]
+    new[70000:70000] = running[4000:9000]
+    new.extend(bytes(rng.getrandbits(8) for _ in range(3000)))
+
+    with open(sys.argv[1], 'wb') as f:
+        f.write(running)
+    with open(sys.argv[2], 'wb') as f:
+        f.write(ota_file(bytes(new), NEW_FILE_VERSION))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Host stand-in for the parts of the ZBOSS API used by the modules under test.
+ *
+ * @details Types and macros follow the nRF52840 port of ZBOSS. The stack timer is a variable the
+ *          tests advance, and the NVRAM read reads from a buffer the tests fill.
+ */
+
+#ifndef ZBOSS_API_H
+#define ZBOSS_API_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef uint8_t  zb_uint8_t;
+typedef int8_t   zb_int8_t;
+typedef uint16_t zb_uint16_t;
+typedef int16_t  zb_int16_t;
+typedef uint32_t zb_uint32_t;
+typedef int32_t  zb_int32_t;
+typedef uint64_t zb_uint64_t;
+typedef char     zb_char_t;
+typedef void     zb_void_t;
+typedef zb_int32_t zb_ret_t;
+typedef zb_uint32_t zb_time_t;
+
+typedef enum
+{
+    ZB_FALSE = 0,
+    ZB_TRUE  = 1
+} zb_bool_t;
+
+#define RET_OK                          0
+#define RET_ERROR                       (-1)
+
+#define ZB_PACKED_PRE
+#define ZB_PACKED_STRUCT                __attribute__((packed))
+
+#define ZB_MEMCPY                       memcpy
+#define ZB_MEMCMP                       memcmp
+#define ZB_BZERO(s, l)                  memset((s), 0, (l))
+#define ZB_LETOH16(dst, src)            memcpy((dst), (src), 2)                 /* Little endian host. */
+#define ZB_LETOH32(dst, src)            memcpy((dst), (src), 4)
+
+#define ZB_ASSERT_COMPILE_DECL(expr)    _Static_assert((expr), #expr)
+
+/* Stack timer, in beacon intervals of 15.36 ms. */
+#define ZB_BEACON_INTERVAL_USEC         15360
+#define ZB_MILLISECONDS_TO_BEACON_INTERVAL(ms) \
+    (((zb_uint32_t)(ms) * 1000 + (ZB_BEACON_INTERVAL_USEC - 1)) / ZB_BEACON_INTERVAL_USEC)
+#define ZB_TIME_BEACON_INTERVAL_TO_MSEC(t) (ZB_BEACON_INTERVAL_USEC / 100 * (zb_time_t)(t) / 10)
+#define ZB_TIME_ONE_SECOND              ZB_MILLISECONDS_TO_BEACON_INTERVAL(1000)
+#define ZB_TIME_SUBTRACT(a, b)          ((zb_time_t)((a) - (b)))
+
+extern zb_time_t stub_timer;
+
+#define ZB_TIMER_GET()                  (stub_timer)
+
+/* Power Configuration cluster, BatterySize values. */
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_NO_BATTERY 0
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_BUILT_IN   1
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER      2
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AA         3
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AAA        4
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_C          5
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_D          6
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_CR2        7
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_CR123A     8
+#define ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_UNKNOWN    0xff
+
+zb_ret_t zb_osif_nvram_read(zb_uint8_t page, zb_uint32_t pos, zb_uint8_t * p_buf, zb_uint16_t len);
+
+#endif /* ZBOSS_API_H */
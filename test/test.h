@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Minimal test harness of the host tests.
+ */
+
+#ifndef TEST_H__
+#define TEST_H__
+
+#include <stdio.h>
+
+static int m_test_failures;
+
+/* Records a failure and carries on, so one run reports every failed check. */
+#define TEST_CHECK(expr)                                                                        \
+    do                                                                                          \
+    {                                                                                           \
+        if (!(expr))                                                                            \
+        {                                                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr);                    \
+            m_test_failures++;                                                                  \
+        }                                                                                       \
+    } while (0)
+
+#define TEST_CHECK_EQUAL(actual, expected)                                                      \
+    do                                                                                          \
+    {                                                                                           \
+        long long test_actual_   = (long long)(actual);                                         \
+        long long test_expected_ = (long long)(expected);                                       \
+        if (test_actual_ != test_expected_)                                                     \
+        {                                                                                       \
+            printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual,          \
+                   test_actual_, test_expected_);                                               \
+            m_test_failures++;                                                                  \
+        }                                                                                       \
+    } while (0)
+
+#define TEST_RUN(test)                                                                          \
+    do                                                                                          \
+    {                                                                                           \
+        int test_failures_before_ = m_test_failures;                                            \
+        test();                                                                                 \
+        printf("%-48s %s\n", #test, (m_test_failures == test_failures_before_) ? "ok" : "FAILED"); \
+    } while (0)
+
+#define TEST_RESULT()                   ((m_test_failures == 0) ? 0 : 1)
+
+#endif // TEST_H__
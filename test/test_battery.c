@@ -0,0 +1,299 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Host tests of the battery capacity estimation and alarm thresholds.
+ */
+
+#include "switch_battery.h"
+#include "test.h"
+
+zb_time_t stub_timer;
+
+static const zb_uint8_t m_volt_thr[BATTERY_ALARM_LEVELS] = { 22, 26, 25, 24 };
+static const zb_uint8_t m_no_thr[BATTERY_ALARM_LEVELS]   = { 0, 0, 0, 0 };
+
+static void test_curve_points(void)
+{
+    /* At and above the top of the curve, and below its end. */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(3000, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 1), 200);
+    TEST_CHECK_EQUAL(battery_remaining_estimate(3300, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 1), 200);
+    TEST_CHECK_EQUAL(battery_remaining_estimate(1900, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 1), 0);
+    /* On a curve point. */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(2700, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 1), 100);
+    TEST_CHECK_EQUAL(battery_remaining_estimate(2400, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 1), 16);
+}
+
+static void test_curve_interpolation(void)
+{
+    /* Halfway between 2700 mV (50%) and 2600 mV (30%). */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(2650, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 1), 80);
+    /* Rounded to the nearest 0.5%: 2601 mV is 30.2%. */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(2601, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 1), 60);
+    /* CR123A, halfway between 2900 mV (75%) and 2800 mV (50%). */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(2850, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_CR123A, 1), 125);
+}
+
+static void test_curve_model_selection(void)
+{
+    /* 1400 mV is 70% of an alkaline cell, and below the end of the lithium curves. */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(1400, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AA, 1), 140);
+    TEST_CHECK_EQUAL(battery_remaining_estimate(1400, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_D, 1), 140);
+    TEST_CHECK_EQUAL(battery_remaining_estimate(1400, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_CR2, 1), 0);
+    TEST_CHECK_EQUAL(battery_remaining_estimate(1400, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_UNKNOWN, 1), 0);
+    TEST_CHECK(battery_model_get(ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_BUILT_IN) ==
+               battery_model_get(ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER));
+}
+
+static void test_curve_series_cells(void)
+{
+    /* Two alkaline cells in series at 2800 mV are 1400 mV each. */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(2800, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AA, 2), 140);
+    /* A quantity of 0 is taken as a single cell. */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(1400, 0, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AA, 0), 140);
+}
+
+static void test_curve_load_compensation(void)
+{
+    /* 3 mA through the 15 ohm of a coin cell drops 45 mV. */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(2605, 3000, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 1), 80);
+    /* 8 mA through the 150 mohm of an alkaline cell drops 1 mV. */
+    TEST_CHECK_EQUAL(battery_remaining_estimate(1399, 8000, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AA, 1), 140);
+}
+
+static void test_charge_account(void)
+{
+    battery_charge_t charge   = { 0 };
+    zb_uint64_t      expected;
+
+    stub_timer         = 10 * ZB_TIME_ONE_SECOND;
+    charge.wakeups     = 100;
+    charge.tx_frames   = 10;
+    charge.used_uah    = 5;
+    charge.used_frac_nc = BATTERY_NC_PER_UAH - 1;
+    expected = (zb_uint64_t)5 * BATTERY_NC_PER_UAH + BATTERY_NC_PER_UAH - 1 +
+               ZB_TIME_BEACON_INTERVAL_TO_MSEC(stub_timer) * BATTERY_SLEEP_CURRENT_UA +
+               100 * BATTERY_WAKEUP_CHARGE_NC + 10 * BATTERY_TX_FRAME_CHARGE_NC;
+
+    battery_charge_account(&charge);
+
+    TEST_CHECK_EQUAL((zb_uint64_t)charge.used_uah * BATTERY_NC_PER_UAH + charge.used_frac_nc, expected);
+    TEST_CHECK(charge.used_frac_nc < BATTERY_NC_PER_UAH);
+    TEST_CHECK_EQUAL(charge.wakeups, 0);
+    TEST_CHECK_EQUAL(charge.tx_frames, 0);
+    TEST_CHECK_EQUAL(charge.accounted_at, stub_timer);
+}
+
+static void test_observer_seed(void)
+{
+    battery_charge_t charge = { 0 };
+
+    stub_timer = 1000;
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 150), 150);
+    TEST_CHECK(charge.seeded);
+    TEST_CHECK_EQUAL(charge.estimate_q, 150UL << BATTERY_OBSERVER_FRAC_BITS);
+    TEST_CHECK_EQUAL(charge.corrected_at, 1000);
+}
+
+static void test_observer_restart(void)
+{
+    battery_charge_t charge = { 0 };
+
+    stub_timer = 0;
+    (void)battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 100);
+    charge.used_uah = 9300;
+
+    /* Up to BATTERY_OBSERVER_RESET above the estimate is noise, and the 9.3 mAh drawn take it to 97... */
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 100 + BATTERY_OBSERVER_RESET), 97);
+    /* ...beyond it a fresh battery, which also clears the coulomb counter. */
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 98 + BATTERY_OBSERVER_RESET), 98 + BATTERY_OBSERVER_RESET);
+    TEST_CHECK_EQUAL(charge.used_uah, 0);
+    TEST_CHECK_EQUAL(charge.observed_uah, 0);
+}
+
+static void test_observer_coulomb_counter(void)
+{
+    battery_charge_t charge = { 0 };
+
+    stub_timer = 0;
+    (void)battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 100);
+
+    /* 6.2 mAh is 1% of the 620 mAh coin cell, the estimate drops by two 0.5% units. */
+    charge.used_uah += 6200;
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 100), 98);
+    TEST_CHECK_EQUAL(charge.estimate_q, 98UL << BATTERY_OBSERVER_FRAC_BITS);
+    TEST_CHECK_EQUAL(charge.observed_uah, charge.used_uah);
+
+    /* Nothing drawn since - no further drop. */
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 100), 98);
+
+    /* 25 mAh is 1% of a 2500 mAh alkaline cell. */
+    charge.used_uah += 25000;
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_AA, 100), 96);
+}
+
+static void test_observer_voltage_correction(void)
+{
+    battery_charge_t charge = { 0 };
+
+    stub_timer = 0;
+    (void)battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 180);
+
+    /* On the flat part the estimate moves by 1/2^BATTERY_OBSERVER_GAIN_SHIFT of the difference. */
+    stub_timer += BATTERY_LEVEL_MEAS_INTERVAL;
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 170), 180);
+    TEST_CHECK_EQUAL(charge.estimate_q, (180UL << BATTERY_OBSERVER_FRAC_BITS) -
+                                        ((10UL << BATTERY_OBSERVER_FRAC_BITS) >> BATTERY_OBSERVER_GAIN_SHIFT));
+}
+
+static void test_observer_knee_gain(void)
+{
+    battery_charge_t charge = { 0 };
+
+    stub_timer = 0;
+    (void)battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 100);
+
+    /* Past the knee the estimate moves by 1/8 of the difference: 100 - 64 / 8. */
+    stub_timer += BATTERY_LEVEL_MEAS_INTERVAL;
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 36), 92);
+}
+
+static void test_observer_once_per_interval(void)
+{
+    battery_charge_t charge = { 0 };
+
+    stub_timer = 0;
+    (void)battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 100);
+
+    /* Within BATTERY_OBSERVER_MIN_STEP of the seed: no correction. */
+    stub_timer += BATTERY_OBSERVER_MIN_STEP - 1;
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 36), 100);
+
+    stub_timer += 1;
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 36), 92);
+
+    /* A second update in the same interval does not weigh the voltage again. */
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 36), 92);
+
+    /* The next interval does: 92 - 56 / 8. */
+    stub_timer += BATTERY_LEVEL_MEAS_INTERVAL;
+    TEST_CHECK_EQUAL(battery_observer_update(&charge, ZB_ZCL_POWER_CONFIG_BATTERY_SIZE_OTHER, 36), 85);
+}
+
+static void test_alarm_voltage_thresholds(void)
+{
+    /* 2550 mV is at or below threshold 1 (2.6 V) only. */
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, m_no_thr, 0, 2550, 200), 0x2);
+    /* Each threshold is reached at its value. */
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, m_no_thr, 0, 2601, 200), 0x0);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, m_no_thr, 0, 2600, 200), 0x2);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, m_no_thr, 0, 2400, 200), 0xE);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, m_no_thr, 0, 2200, 200), 0xF);
+}
+
+static void test_alarm_voltage_hysteresis(void)
+{
+    /* An active level clears once the voltage is BATTERY_ALARM_HYSTERESIS_MV above its threshold. */
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, m_no_thr, 0x2, 2600 + BATTERY_ALARM_HYSTERESIS_MV - 1, 200), 0x2);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, m_no_thr, 0x2, 2600 + BATTERY_ALARM_HYSTERESIS_MV, 200), 0x0);
+    /* An inactive level is not raised within the hysteresis. */
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, m_no_thr, 0x0, 2600 + 1, 200), 0x0);
+}
+
+static void test_alarm_percentage_units(void)
+{
+    const zb_uint8_t pct_thr[BATTERY_ALARM_LEVELS] = { 0, 10, 0, 0 };
+
+    /* The thresholds are whole percent, BatteryPercentageRemaining 0.5% units: 10% is 20. */
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_no_thr, pct_thr, 0, 3000, 21), 0x0);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_no_thr, pct_thr, 0, 3000, 20), 0x2);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_no_thr, pct_thr, 0, 3000, 10), 0x2);
+}
+
+static void test_alarm_percentage_hysteresis(void)
+{
+    const zb_uint8_t pct_thr[BATTERY_ALARM_LEVELS] = { 0, 10, 0, 0 };
+
+    /* Clears at 12%, BATTERY_ALARM_HYSTERESIS_PCT whole percent above the threshold. */
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_no_thr, pct_thr, 0x2, 3000, 2 * (10 + BATTERY_ALARM_HYSTERESIS_PCT) - 1), 0x2);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_no_thr, pct_thr, 0x2, 3000, 2 * (10 + BATTERY_ALARM_HYSTERESIS_PCT)), 0x0);
+}
+
+static void test_alarm_either_threshold(void)
+{
+    const zb_uint8_t pct_thr[BATTERY_ALARM_LEVELS] = { 0, 10, 0, 0 };
+
+    /* Level 1 stays active while either its voltage or its percentage threshold holds it. */
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, pct_thr, 0x0, 2700, 20), 0x2);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, pct_thr, 0x0, 2600, 200), 0x2);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_volt_thr, pct_thr, 0x2, 2700, 200), 0x0);
+}
+
+static void test_alarm_disabled_thresholds(void)
+{
+    /* Zero thresholds are not used, and the bits above the levels are left alone. */
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_no_thr, m_no_thr, 0x0, 0, 0), 0x0);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_no_thr, m_no_thr, 0xF, 0, 0), 0x0);
+    TEST_CHECK_EQUAL(battery_alarm_state_evaluate(m_no_thr, m_no_thr, 0x40000000, 0, 0), 0x40000000);
+}
+
+int main(void)
+{
+    TEST_RUN(test_curve_points);
+    TEST_RUN(test_curve_interpolation);
+    TEST_RUN(test_curve_model_selection);
+    TEST_RUN(test_curve_series_cells);
+    TEST_RUN(test_curve_load_compensation);
+    TEST_RUN(test_charge_account);
+    TEST_RUN(test_observer_seed);
+    TEST_RUN(test_observer_restart);
+    TEST_RUN(test_observer_coulomb_counter);
+    TEST_RUN(test_observer_voltage_correction);
+    TEST_RUN(test_observer_knee_gain);
+    TEST_RUN(test_observer_once_per_interval);
+    TEST_RUN(test_alarm_voltage_thresholds);
+    TEST_RUN(test_alarm_voltage_hysteresis);
+    TEST_RUN(test_alarm_percentage_units);
+    TEST_RUN(test_alarm_percentage_hysteresis);
+    TEST_RUN(test_alarm_either_threshold);
+    TEST_RUN(test_alarm_disabled_thresholds);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,271 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Host tests of the application NVRAM dataset read path and the persistent attributes.
+ */
+
+#include "switch_nvram.h"
+#include "app_util.h"
+#include "test.h"
+
+#define TEST_DATA_VERSION               3
+
+typedef ZB_PACKED_PRE struct test_data_s
+{
+    switch_nvram_header_t header;
+    zb_uint32_t           counter;
+    zb_uint8_t            level;
+    zb_char_t             name[5];      /**< ZCL string, length byte first. */
+} ZB_PACKED_STRUCT test_data_t;
+
+/* Dataset of the previous firmware version, without the name. */
+typedef ZB_PACKED_PRE struct test_data_old_s
+{
+    switch_nvram_header_t header;
+    zb_uint32_t           counter;
+    zb_uint8_t            level;
+} ZB_PACKED_STRUCT test_data_old_t;
+
+static zb_uint32_t m_counter;
+static zb_uint8_t  m_level;
+static zb_char_t   m_name[5];
+
+static const switch_persistent_attr_t m_attrs[] =
+{
+    SWITCH_NVRAM_ATTR( test_data_t, 1, 0x0000, 0x0010, &m_counter, counter ),
+    SWITCH_NVRAM_ATTR( test_data_t, 1, 0x0001, 0x0034, &m_level,   level ),
+    SWITCH_NVRAM_ATTR( test_data_t, 2, 0x0000, 0x0010, m_name,     name ),
+};
+
+/* Flash the stub NVRAM read is served from. */
+static zb_uint8_t m_flash[256];
+static zb_ret_t   m_read_status;
+static int        m_reads;
+
+zb_time_t stub_timer;
+
+zb_ret_t zb_osif_nvram_read(zb_uint8_t page, zb_uint32_t pos, zb_uint8_t * p_buf, zb_uint16_t len)
+{
+    (void)page;
+    m_reads++;
+    if (m_read_status != RET_OK)
+    {
+        memset(p_buf, 0xA5, len);
+        return m_read_status;
+    }
+
+    memcpy(p_buf, &m_flash[pos], len);
+    return RET_OK;
+}
+
+static void flash_store(zb_uint32_t pos, const void * p_data, size_t size)
+{
+    memset(m_flash, 0xFF, sizeof(m_flash));
+    memcpy(&m_flash[pos], p_data, size);
+    m_read_status = RET_OK;
+    m_reads       = 0;
+}
+
+static void attrs_default(void)
+{
+    m_counter = 7;
+    m_level   = 0xFE;
+    memcpy(m_name, "\x04test", sizeof(m_name));
+}
+
+static test_data_t test_data(void)
+{
+    test_data_t data;
+
+    memset(&data, 0, sizeof(data));
+    data.header.version = TEST_DATA_VERSION;
+    data.header.length  = sizeof(data);
+    data.counter        = 0x12345678;
+    data.level          = 42;
+    memcpy(data.name, "\x04home", sizeof(data.name));
+
+    return data;
+}
+
+static void test_read_same_version(void)
+{
+    test_data_t stored = test_data();
+    test_data_t data;
+
+    flash_store(16, &stored, sizeof(stored));
+    TEST_CHECK_EQUAL(switch_nvram_dataset_read(0, 16, sizeof(stored), &data, sizeof(data), TEST_DATA_VERSION), sizeof(data));
+    TEST_CHECK(memcmp(&data, &stored, sizeof(data)) == 0);
+}
+
+static void test_read_newer_dataset(void)
+{
+    zb_uint8_t  stored[sizeof(test_data_t) + 6];
+    test_data_t fields = test_data();
+    test_data_t data;
+
+    /* A newer firmware appended fields - only the ones this firmware knows are read. */
+    fields.header.length = sizeof(stored);
+    memset(stored, 0x5A, sizeof(stored));
+    memcpy(stored, &fields, sizeof(fields));
+    flash_store(0, stored, sizeof(stored));
+
+    TEST_CHECK_EQUAL(switch_nvram_dataset_read(0, 0, sizeof(stored), &data, sizeof(data), TEST_DATA_VERSION), sizeof(data));
+    TEST_CHECK_EQUAL(data.counter, 0x12345678);
+    TEST_CHECK(memcmp(data.name, "\x04home", sizeof(data.name)) == 0);
+}
+
+static void test_read_older_dataset(void)
+{
+    test_data_old_t stored;
+    test_data_t     data;
+    zb_uint16_t     length;
+
+    stored.header.version = TEST_DATA_VERSION;
+    stored.header.length  = sizeof(stored);
+    stored.counter        = 99;
+    stored.level          = 3;
+    flash_store(0, &stored, sizeof(stored));
+
+    length = switch_nvram_dataset_read(0, 0, sizeof(stored), &data, sizeof(data), TEST_DATA_VERSION);
+    TEST_CHECK_EQUAL(length, sizeof(stored));
+
+    /* Attributes missing from the shorter dataset keep their values. */
+    attrs_default();
+    switch_nvram_attrs_restore(m_attrs, ARRAY_SIZE(m_attrs), &data, length);
+    TEST_CHECK_EQUAL(m_counter, 99);
+    TEST_CHECK_EQUAL(m_level, 3);
+    TEST_CHECK(memcmp(m_name, "\x04test", sizeof(m_name)) == 0);
+}
+
+static void test_read_other_version(void)
+{
+    test_data_t stored = test_data();
+    test_data_t data;
+    test_data_t zero;
+
+    stored.header.version = TEST_DATA_VERSION + 1;
+    flash_store(0, &stored, sizeof(stored));
+    memset(&zero, 0, sizeof(zero));
+
+    TEST_CHECK_EQUAL(switch_nvram_dataset_read(0, 0, sizeof(stored), &data, sizeof(data), TEST_DATA_VERSION), 0);
+    TEST_CHECK(memcmp(&data, &zero, sizeof(data)) == 0);
+}
+
+static void test_read_length_mismatch(void)
+{
+    test_data_t stored = test_data();
+    test_data_t data;
+
+    /* The header does not match the size the stack stored, e.g. a dataset without a header. */
+    stored.header.length = sizeof(stored) - 1;
+    flash_store(0, &stored, sizeof(stored));
+    TEST_CHECK_EQUAL(switch_nvram_dataset_read(0, 0, sizeof(stored), &data, sizeof(data), TEST_DATA_VERSION), 0);
+
+    stored.header.length = sizeof(stored);
+    flash_store(0, &stored, sizeof(stored));
+    TEST_CHECK_EQUAL(switch_nvram_dataset_read(0, 0, sizeof(stored) + 4, &data, sizeof(data), TEST_DATA_VERSION), 0);
+}
+
+static void test_read_too_short(void)
+{
+    test_data_t stored = test_data();
+    test_data_t data;
+
+    flash_store(0, &stored, sizeof(stored));
+    TEST_CHECK_EQUAL(switch_nvram_dataset_read(0, 0, sizeof(switch_nvram_header_t) - 1, &data, sizeof(data), TEST_DATA_VERSION), 0);
+    TEST_CHECK_EQUAL(m_reads, 0);
+}
+
+static void test_read_failure(void)
+{
+    test_data_t stored = test_data();
+    test_data_t data;
+    test_data_t zero;
+
+    flash_store(0, &stored, sizeof(stored));
+    m_read_status = RET_ERROR;
+    memset(&zero, 0, sizeof(zero));
+
+    TEST_CHECK_EQUAL(switch_nvram_dataset_read(0, 0, sizeof(stored), &data, sizeof(data), TEST_DATA_VERSION), 0);
+    TEST_CHECK(memcmp(&data, &zero, sizeof(data)) == 0);
+}
+
+static void test_attrs_store_and_restore(void)
+{
+    test_data_t data;
+
+    memset(&data, 0, sizeof(data));
+    attrs_default();
+    switch_nvram_attrs_store(m_attrs, ARRAY_SIZE(m_attrs), &data);
+    TEST_CHECK_EQUAL(data.counter, 7);
+    TEST_CHECK_EQUAL(data.level, 0xFE);
+    TEST_CHECK(memcmp(data.name, "\x04test", sizeof(data.name)) == 0);
+    TEST_CHECK(!switch_nvram_attrs_changed(m_attrs, ARRAY_SIZE(m_attrs), &data));
+
+    m_name[4] = 'x';
+    TEST_CHECK(switch_nvram_attrs_changed(m_attrs, ARRAY_SIZE(m_attrs), &data));
+
+    switch_nvram_attrs_restore(m_attrs, ARRAY_SIZE(m_attrs), &data, sizeof(data));
+    TEST_CHECK(memcmp(m_name, "\x04test", sizeof(m_name)) == 0);
+}
+
+static void test_attr_find(void)
+{
+    TEST_CHECK(switch_nvram_attr_find(m_attrs, ARRAY_SIZE(m_attrs), 1, 0x0001, 0x0034) == &m_attrs[1]);
+    TEST_CHECK(switch_nvram_attr_find(m_attrs, ARRAY_SIZE(m_attrs), 2, 0x0000, 0x0010) == &m_attrs[2]);
+    TEST_CHECK(switch_nvram_attr_find(m_attrs, ARRAY_SIZE(m_attrs), 2, 0x0001, 0x0034) == NULL);
+    TEST_CHECK(switch_nvram_attr_find(m_attrs, ARRAY_SIZE(m_attrs), 1, 0x0000, 0x0011) == NULL);
+}
+
+int main(void)
+{
+    TEST_RUN(test_read_same_version);
+    TEST_RUN(test_read_newer_dataset);
+    TEST_RUN(test_read_older_dataset);
+    TEST_RUN(test_read_other_version);
+    TEST_RUN(test_read_length_mismatch);
+    TEST_RUN(test_read_too_short);
+    TEST_RUN(test_read_failure);
+    TEST_RUN(test_attrs_store_and_restore);
+    TEST_RUN(test_attr_find);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,463 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Host tests of the delta OTA image decoder.
+ *
+ * @details Run with the running image, the full OTA file and the delta image made from them by
+ *          tools/make_ota_delta.py, the decoder is also checked to build the full OTA file back
+ *          from the delta, fed in blocks of various sizes.
+ */
+
+#include <stdlib.h>
+
+#include "switch_ota_delta.h"
+#include "nordic_common.h"
+#include "app_util.h"
+#include "test.h"
+
+#define TEST_OTA_BASE_VERSION           0x01020304                              /**< --base-version given to make_ota_delta.py by the Makefile. */
+#define TEST_OTA_HEADER_LENGTH          56
+#define TEST_OTA_IMAGE_MIN              (TEST_OTA_HEADER_LENGTH + 6 + 32)
+#define TEST_OTA_IMAGE_MAX              0x60000
+
+zb_time_t stub_timer;
+
+static const zb_uint8_t m_running[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+typedef struct
+{
+    zb_uint8_t  data[512];
+    zb_uint16_t len;
+    zb_uint16_t patch_start;            /**< Offset of the patch length field. */
+} test_delta_t;
+
+static void put(test_delta_t * p_delta, const void * p_data, zb_uint16_t len)
+{
+    memcpy(&p_delta->data[p_delta->len], p_data, len);
+    p_delta->len += len;
+}
+
+static void put16(test_delta_t * p_delta, zb_uint16_t value)
+{
+    zb_uint8_t bytes[2] = { (zb_uint8_t)value, (zb_uint8_t)(value >> 8) };
+
+    put(p_delta, bytes, sizeof(bytes));
+}
+
+static void put32(test_delta_t * p_delta, zb_uint32_t value)
+{
+    put16(p_delta, (zb_uint16_t)value);
+    put16(p_delta, (zb_uint16_t)(value >> 16));
+}
+
+/* OTA file header, patch tag and patch header. The patch length is set by delta_end. */
+static void delta_begin(test_delta_t * p_delta, zb_uint32_t base_version, zb_uint32_t image_length)
+{
+    memset(p_delta, 0, sizeof(*p_delta));
+    put32(p_delta, 0x0BEEF11E);
+    put16(p_delta, 0x0100);
+    put16(p_delta, TEST_OTA_HEADER_LENGTH);
+    p_delta->len = TEST_OTA_HEADER_LENGTH;
+    put16(p_delta, SWITCH_OTA_TAG_DELTA_PATCH);
+    p_delta->patch_start = p_delta->len;
+    put32(p_delta, 0);
+    put32(p_delta, base_version);
+    put32(p_delta, image_length);
+}
+
+static void delta_copy(test_delta_t * p_delta, zb_uint32_t offset, zb_uint16_t len)
+{
+    zb_uint8_t op = SWITCH_OTA_DELTA_OP_COPY;
+
+    put(p_delta, &op, 1);
+    put32(p_delta, offset);
+    put16(p_delta, len);
+}
+
+static void delta_insert(test_delta_t * p_delta, const char * p_bytes)
+{
+    zb_uint8_t op = SWITCH_OTA_DELTA_OP_INSERT;
+
+    put(p_delta, &op, 1);
+    put16(p_delta, (zb_uint16_t)strlen(p_bytes));
+    put(p_delta, p_bytes, (zb_uint16_t)strlen(p_bytes));
+}
+
+static void delta_end(test_delta_t * p_delta)
+{
+    zb_uint32_t patch_len = p_delta->len - p_delta->patch_start - 4;
+
+    memcpy(&p_delta->data[p_delta->patch_start], &patch_len, sizeof(patch_len));
+}
+
+/**@brief Function for decoding a delta image fed in blocks of block_size bytes.
+ *
+ * @return ZB_FALSE if the decoder rejected the image. The built file is in p_out.
+ */
+static zb_bool_t delta_apply(const zb_uint8_t * p_running, zb_uint32_t running_size,
+                             const zb_uint8_t * p_image, zb_uint32_t image_len, zb_uint16_t block_size,
+                             zb_uint8_t * p_out, zb_uint32_t out_size, zb_uint32_t * p_out_len,
+                             switch_ota_delta_t * p_delta)
+{
+    zb_uint32_t offset = 0;
+
+    switch_ota_delta_init(p_delta, p_running, running_size, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN, TEST_OTA_IMAGE_MAX);
+    *p_out_len = 0;
+
+    while (offset < image_len)
+    {
+        zb_uint16_t        len = (zb_uint16_t)MIN(block_size, image_len - offset);
+        const zb_uint8_t * p_part;
+        zb_uint16_t        part_len;
+
+        switch_ota_delta_input(p_delta, p_image + offset, len);
+        offset += len;
+
+        do
+        {
+            if (!switch_ota_delta_decode(p_delta, &p_part, &part_len))
+            {
+                return ZB_FALSE;
+            }
+            if (*p_out_len + part_len > out_size)
+            {
+                return ZB_FALSE;
+            }
+            memcpy(p_out + *p_out_len, p_part, part_len);
+            *p_out_len += part_len;
+        } while (part_len > 0);
+    }
+
+    return ZB_TRUE;
+}
+
+static zb_bool_t delta_apply_small(const test_delta_t * p_image, zb_uint16_t block_size, zb_uint8_t * p_out,
+                                   zb_uint32_t * p_out_len, switch_ota_delta_t * p_delta)
+{
+    return delta_apply(m_running, sizeof(m_running) - 1, p_image->data, p_image->len, block_size,
+                       p_out, 256, p_out_len, p_delta);
+}
+
+/* The smallest OTA file the decoder accepts, built from the running image and inserted bytes. */
+static zb_uint32_t delta_valid(test_delta_t * p_delta, zb_uint8_t * p_expected)
+{
+    char        filler[TEST_OTA_IMAGE_MIN - 16 + 1];
+    zb_uint32_t len = 0;
+
+    memset(filler, '.', sizeof(filler) - 1);
+    filler[sizeof(filler) - 1] = '\0';
+
+    delta_begin(p_delta, TEST_OTA_BASE_VERSION, 10 + 4 + TEST_OTA_IMAGE_MIN);
+    delta_copy(p_delta, 26, 10);
+    memcpy(&p_expected[len], "qrstuvwxyz", 10);
+    len += 10;
+    delta_insert(p_delta, "ABCD");
+    memcpy(&p_expected[len], "ABCD", 4);
+    len += 4;
+    delta_copy(p_delta, 0, 16);
+    memcpy(&p_expected[len], m_running, 16);
+    len += 16;
+    delta_insert(p_delta, "");
+    delta_copy(p_delta, 0, 0);
+    delta_insert(p_delta, filler);
+    memcpy(&p_expected[len], filler, sizeof(filler) - 1);
+    len += sizeof(filler) - 1;
+    delta_end(p_delta);
+
+    return len;
+}
+
+static void test_decode_commands(void)
+{
+    static const zb_uint16_t block_sizes[] = { 1, 2, 5, 8, 64, 512 };
+    test_delta_t             image;
+    switch_ota_delta_t       delta;
+    zb_uint8_t               expected[256];
+    zb_uint8_t               out[256];
+    zb_uint32_t              expected_len = delta_valid(&image, expected);
+    zb_uint32_t              out_len;
+
+    for (zb_uint8_t i = 0; i < ARRAY_SIZE(block_sizes); i++)
+    {
+        TEST_CHECK(delta_apply_small(&image, block_sizes[i], out, &out_len, &delta));
+        TEST_CHECK(switch_ota_delta_complete(&delta));
+        TEST_CHECK_EQUAL(out_len, expected_len);
+        TEST_CHECK(memcmp(out, expected, expected_len) == 0);
+    }
+}
+
+static void test_decode_ignores_trailing_tags(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         expected[256];
+    zb_uint8_t         out[256];
+    zb_uint32_t        expected_len = delta_valid(&image, expected);
+    zb_uint32_t        out_len;
+
+    put16(&image, 0xF0FF);
+    put32(&image, 4);
+    put32(&image, 0xFFFFFFFF);
+
+    TEST_CHECK(delta_apply_small(&image, 7, out, &out_len, &delta));
+    TEST_CHECK(switch_ota_delta_complete(&delta));
+    TEST_CHECK_EQUAL(out_len, expected_len);
+}
+
+static void test_decode_other_base_version(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         out[256];
+    zb_uint32_t        out_len;
+
+    delta_begin(&image, TEST_OTA_BASE_VERSION + 1, TEST_OTA_IMAGE_MIN);
+    delta_copy(&image, 0, 10);
+    delta_end(&image);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+    TEST_CHECK_EQUAL(out_len, 0);
+}
+
+static void test_decode_image_length_limits(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         out[256];
+    zb_uint32_t        out_len;
+
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN - 1);
+    delta_end(&image);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MAX + 1);
+    delta_end(&image);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+}
+
+static void test_decode_copy_out_of_range(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         out[256];
+    zb_uint32_t        out_len;
+
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN);
+    delta_copy(&image, 30, 7);
+    delta_end(&image);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN);
+    delta_copy(&image, 0xFFFFFFF0, 0x20);
+    delta_end(&image);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+}
+
+static void test_decode_overrun(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         out[256];
+    zb_uint32_t        out_len;
+
+    /* The commands build more than the length in the patch header. */
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN);
+    for (zb_uint8_t i = 0; i < 3; i++)
+    {
+        delta_copy(&image, 0, 36);
+    }
+    delta_end(&image);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+}
+
+static void test_decode_unknown_command(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         out[256];
+    zb_uint32_t        out_len;
+    zb_uint8_t         op = 0x03;
+
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN);
+    put(&image, &op, 1);
+    delta_end(&image);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+}
+
+static void test_decode_truncated_patch(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         out[256];
+    zb_uint32_t        out_len;
+
+    /* The patch ends within a COPY command. */
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN);
+    delta_copy(&image, 0, 10);
+    image.len -= 2;
+    delta_end(&image);
+    put16(&image, 0);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+}
+
+static void test_decode_without_patch(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         out[256];
+    zb_uint32_t        out_len;
+
+    /* A full image - the first tag is the upgrade image. */
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN);
+    image.data[TEST_OTA_HEADER_LENGTH] = 0x00;
+    image.data[TEST_OTA_HEADER_LENGTH + 1] = 0x00;
+    delta_end(&image);
+    TEST_CHECK(!delta_apply_small(&image, 64, out, &out_len, &delta));
+}
+
+static void test_decode_incomplete(void)
+{
+    test_delta_t       image;
+    switch_ota_delta_t delta;
+    zb_uint8_t         out[256];
+    zb_uint32_t        out_len;
+
+    /* A well formed patch that builds less than the length in its header. */
+    delta_begin(&image, TEST_OTA_BASE_VERSION, TEST_OTA_IMAGE_MIN);
+    delta_copy(&image, 0, 36);
+    delta_end(&image);
+    TEST_CHECK(delta_apply_small(&image, 64, out, &out_len, &delta));
+    TEST_CHECK(!switch_ota_delta_complete(&delta));
+
+    /* The image stops before the end of the patch. */
+    delta_valid(&image, out);
+    image.len -= 5;
+    TEST_CHECK(delta_apply_small(&image, 64, out, &out_len, &delta));
+    TEST_CHECK(!switch_ota_delta_complete(&delta));
+}
+
+static zb_uint8_t * file_read(const char * p_path, zb_uint32_t * p_len)
+{
+    FILE       * p_file = fopen(p_path, "rb");
+    zb_uint8_t * p_data;
+    long         len;
+
+    if (p_file == NULL || fseek(p_file, 0, SEEK_END) != 0 || (len = ftell(p_file)) < 0)
+    {
+        printf("cannot read %s\n", p_path);
+        exit(1);
+    }
+    rewind(p_file);
+    p_data = malloc(len ? len : 1);
+    if (p_data == NULL || fread(p_data, 1, len, p_file) != (size_t)len)
+    {
+        printf("cannot read %s\n", p_path);
+        exit(1);
+    }
+    fclose(p_file);
+
+    *p_len = (zb_uint32_t)len;
+    return p_data;
+}
+
+static const char * m_running_path;
+static const char * m_new_path;
+static const char * m_delta_path;
+
+static void test_round_trip(void)
+{
+    /* 1 and 7 exercise fields split across blocks; 64 is SWITCH_OTA_BLOCK_SIZE. */
+    static const zb_uint16_t block_sizes[] = { 1, 7, 64, 65, 4096, 0xFFFF };
+    zb_uint32_t              running_len;
+    zb_uint32_t              new_len;
+    zb_uint32_t              delta_len;
+    zb_uint8_t             * p_running = file_read(m_running_path, &running_len);
+    zb_uint8_t             * p_new     = file_read(m_new_path, &new_len);
+    zb_uint8_t             * p_delta   = file_read(m_delta_path, &delta_len);
+    zb_uint8_t             * p_out     = malloc(new_len);
+    switch_ota_delta_t       delta;
+    zb_uint32_t              out_len;
+
+    printf("delta image of %u bytes for an OTA file of %u bytes\n", delta_len, new_len);
+    TEST_CHECK(delta_len < new_len / 10);
+
+    for (zb_uint8_t i = 0; i < ARRAY_SIZE(block_sizes); i++)
+    {
+        TEST_CHECK(delta_apply(p_running, running_len, p_delta, delta_len, block_sizes[i],
+                               p_out, new_len, &out_len, &delta));
+        TEST_CHECK(switch_ota_delta_complete(&delta));
+        TEST_CHECK_EQUAL(out_len, new_len);
+        TEST_CHECK(memcmp(p_out, p_new, new_len) == 0);
+    }
+
+    /* The same delta does not apply to another running image. */
+    p_running[running_len / 2] ^= 0xFF;
+    TEST_CHECK(delta_apply(p_running, running_len, p_delta, delta_len, 64, p_out, new_len, &out_len, &delta));
+    TEST_CHECK(memcmp(p_out, p_new, new_len) != 0);
+
+    free(p_out);
+    free(p_delta);
+    free(p_new);
+    free(p_running);
+}
+
+int main(int argc, char * argv[])
+{
+    TEST_RUN(test_decode_commands);
+    TEST_RUN(test_decode_ignores_trailing_tags);
+    TEST_RUN(test_decode_other_base_version);
+    TEST_RUN(test_decode_image_length_limits);
+    TEST_RUN(test_decode_copy_out_of_range);
+    TEST_RUN(test_decode_overrun);
+    TEST_RUN(test_decode_unknown_command);
+    TEST_RUN(test_decode_truncated_patch);
+    TEST_RUN(test_decode_without_patch);
+    TEST_RUN(test_decode_incomplete);
+
+    if (argc == 4)
+    {
+        m_running_path = argv[1];
+        m_new_path     = argv[2];
+        m_delta_path   = argv[3];
+        TEST_RUN(test_round_trip);
+    }
+
+    return TEST_RESULT();
+}
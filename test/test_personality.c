@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) 2018 - 2019, Nordic Semiconductor ASA
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form, except as embedded into a Nordic
+ *    Semiconductor ASA integrated circuit in a product or a software update for
+ *    such product, must reproduce the above copyright notice, this list of
+ *    conditions and the following disclaimer in the documentation and/or other
+ *    materials provided with the distribution.
+ *
+ * 3. Neither the name of Nordic Semiconductor ASA nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * 4. This software, with or without modification, must only be used with a
+ *    Nordic Semiconductor ASA integrated circuit.
+ *
+ * 5. Any software provided in binary form under this license must not be reverse
+ *    engineered, decompiled, modified and/or disassembled.
+ *
+ * THIS SOFTWARE IS PROVIDED BY NORDIC SEMICONDUCTOR ASA "AS IS" AND ANY EXPRESS
+ * OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY, NONINFRINGEMENT, AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL NORDIC SEMICONDUCTOR ASA OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+/** @file
+ *
+ * @brief Host tests of the button event frames of the personalities.
+ *
+ * @details The reference frames are written by hand from the published layouts - the FC00 button
+ *          event of the Hue switches and the GP Notification of the Green Power specification. They
+ *          are not captured from the devices, so they catch changes of the encoders, not a wrong
+ *          reading of the layout.
+ */
+
+#include "switch_personality.h"
+#include "switch_gp.h"
+#include "test.h"
+
+zb_time_t stub_timer;
+
+/* FC00 button event payload as sent on air: the 64-bit value, little endian. */
+static zb_bool_t hue_event_matches(zb_uint64_t data, const zb_uint8_t expected[8])
+{
+    for (zb_uint8_t i = 0; i < 8; i++)
+    {
+        if ((zb_uint8_t)(data >> (8 * i)) != expected[i])
+        {
+            return ZB_FALSE;
+        }
+    }
+    return ZB_TRUE;
+}
+
+static void test_hue_event_press(void)
+{
+    /* Button 1, initial press. */
+    static const zb_uint8_t expected[8] = { 0x01, 0x00, 0x00, 0x30, 0x00, 0x21, 0x00, 0x00 };
+
+    TEST_CHECK(hue_event_matches(SWITCH_HUE_EVENT_DATA(1, 0x00, 0), expected));
+}
+
+static void test_hue_event_hold(void)
+{
+    /* Button 2, held for 0.8 s. */
+    static const zb_uint8_t expected[8] = { 0x02, 0x00, 0x00, 0x30, 0x01, 0x21, 0x08, 0x00 };
+
+    TEST_CHECK(hue_event_matches(SWITCH_HUE_EVENT_DATA(2, 0x01, 8), expected));
+}
+
+static void test_hue_event_long_release(void)
+{
+    /* Button 4, released after a 2.5 s hold. */
+    static const zb_uint8_t expected[8] = { 0x04, 0x00, 0x00, 0x30, 0x03, 0x21, 0x19, 0x00 };
+
+    TEST_CHECK(hue_event_matches(SWITCH_HUE_EVENT_DATA(4, 0x03, 25), expected));
+}
+
+static void test_personality_buttons(void)
+{
+    /* The dimmer reports its buttons as 1-4. */
+    TEST_CHECK_EQUAL(SWITCH_PERSONALITY_EVENT_DATA(0, 0x00, 0) & 0xFF, 1);
+    TEST_CHECK_EQUAL(SWITCH_PERSONALITY_EVENT_DATA(SWITCH_PERSONALITY_BUTTON_COUNT - 1, 0x00, 0) & 0xFF, 4);
+}
+
+static void test_tap_gpd_commands(void)
+{
+    TEST_CHECK_EQUAL(SWITCH_HUE_TAP_GPD_CMD(0), 0x22);
+    TEST_CHECK_EQUAL(SWITCH_HUE_TAP_GPD_CMD(1), 0x10);
+    TEST_CHECK_EQUAL(SWITCH_HUE_TAP_GPD_CMD(2), 0x11);
+    TEST_CHECK_EQUAL(SWITCH_HUE_TAP_GPD_CMD(3), 0x12);
+}
+
+static void test_gp_notification(void)
+{
+    /* Options (Also Unicast), SrcID, frame counter, GPD command 0x22, no GPD payload. */
+    static const zb_uint8_t expected[] = { 0x08, 0x00,
+                                           0x78, 0x56, 0x34, 0x12,
+                                           0x05, 0x01, 0x00, 0x00,
+                                           0x22,
+                                           0x00 };
+    zb_uint8_t              frame[SWITCH_GP_NOTIFICATION_MAX_SIZE + 1];
+    zb_uint8_t              len;
+
+    memset(frame, 0xAA, sizeof(frame));
+    len = switch_gp_notification_put(frame, 0x12345678, 0x105, SWITCH_HUE_TAP_GPD_CMD(0));
+    TEST_CHECK_EQUAL(len, sizeof(expected));
+    TEST_CHECK(memcmp(frame, expected, sizeof(expected)) == 0);
+    TEST_CHECK_EQUAL(frame[len], 0xAA);
+}
+
+static void test_gp_commissioning_notification(void)
+{
+    /* Options, SrcID, frame counter, GPD Commissioning with device ID 0x02 and no GPD options. */
+    static const zb_uint8_t expected[] = { 0x00, 0x00,
+                                           0xEF, 0xBE, 0xAD, 0xDE,
+                                           0x00, 0x00, 0x00, 0x00,
+                                           0xE0,
+                                           0x02, 0x02, 0x00 };
+    zb_uint8_t              frame[SWITCH_GP_NOTIFICATION_MAX_SIZE + 1];
+    zb_uint8_t              len;
+
+    memset(frame, 0xAA, sizeof(frame));
+    len = switch_gp_commissioning_put(frame, 0xDEADBEEF, 0, SWITCH_GPD_DEVICE_ID_ON_OFF_SWITCH);
+    TEST_CHECK_EQUAL(len, sizeof(expected));
+    TEST_CHECK(len <= SWITCH_GP_NOTIFICATION_MAX_SIZE);
+    TEST_CHECK(memcmp(frame, expected, sizeof(expected)) == 0);
+    TEST_CHECK_EQUAL(frame[len], 0xAA);
+}
+
+int main(void)
+{
+    TEST_RUN(test_hue_event_press);
+    TEST_RUN(test_hue_event_hold);
+    TEST_RUN(test_hue_event_long_release);
+    TEST_RUN(test_personality_buttons);
+    TEST_RUN(test_tap_gpd_commands);
+    TEST_RUN(test_gp_notification);
+    TEST_RUN(test_gp_commissioning_notification);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,129 @@
+"""Build a delta OTA image for the light switch.
+
+The delta image carries the OTA file header of the new image, with the delta image type and
+its own size, followed by a patch tag that builds the full OTA file of the new version from
+the running image (see switch_ota_delta.h for the format):
+
+    python3 make_ota_delta.py --base-version 0x420045b6 running.bin new.ota delta.ota
+
+running.bin is the application as it is in flash from SWITCH_OTA_RUNNING_START, i.e. the
+.bin of the firmware the switches run. new.ota is the full OTA file of the new version,
+SHA-256 tag included. The patch is found greedily: each position of the new file is looked up
+in an index of the running image, and the longest match is copied. Bytes without a match long
+enough to pay for a COPY command are inserted.
+"""
+
+import argparse
+import struct
+import sys
+
+OTA_FILE_ID = 0x0BEEF11E
+OTA_HEADER_IMAGE_TYPE_OFFSET = 10
+OTA_HEADER_TOTAL_SIZE_OFFSET = 52
+OTA_HEADER_MIN_SIZE = 56
+
+IMAGE_TYPE_DELTA = 0x8001
+TAG_DELTA_PATCH = 0xF001
+OP_COPY = 0x01
+OP_INSERT = 0x02
+
+COPY_SIZE = 7                   # COPY command: op, offset (4), length (2).
+INSERT_SIZE = 3                 # INSERT command: op, length (2), then the bytes.
+MAX_LENGTH = 0xFFFF             # Longest COPY or INSERT command.
+KEY_SIZE = 8                    # Bytes a match is indexed by.
+MIN_MATCH = COPY_SIZE + INSERT_SIZE  # Shorter matches are cheaper to insert.
+MAX_CANDIDATES = 16             # Positions of the running image tried per lookup.
+
+
+def index_image(image):
+    """Map each KEY_SIZE byte sequence of the image to the positions it starts at."""
+    index = {}
+    for pos in range(len(image) - KEY_SIZE + 1):
+        positions = index.setdefault(image[pos:pos + KEY_SIZE], [])
+        if len(positions) < MAX_CANDIDATES:
+            positions.append(pos)
+    return index
+
+
+def longest_match(image, index, target, pos):
+    """Return (offset, length) of the longest match of target[pos:] in image."""
+    best_offset, best_length = 0, 0
+    limit = min(len(target) - pos, MAX_LENGTH)
+    for offset in index.get(target[pos:pos + KEY_SIZE], ()):
+        length = KEY_SIZE
+        end = min(limit, len(image) - offset)
+        while length < end and image[offset + length] == target[pos + length]:
+            length += 1
+        if length > best_length:
+            best_offset, best_length = offset, length
+    return best_offset, best_length
+
+
+def make_patch(running, target):
+    """Return the COPY and INSERT commands building target from running."""
+    index = index_image(running)
+    commands = bytearray()
+    pending = bytearray()
+
+    def flush():
+        for start in range(0, len(pending), MAX_LENGTH):
+            chunk = pending[start:start + MAX_LENGTH]
+            commands.extend(struct.pack('<BH', OP_INSERT, len(chunk)))
+            commands.extend(chunk)
+        del pending[:]
+
+    pos = 0
+    while pos < len(target):
+        offset, length = longest_match(running, index, target, pos)
+        if length >= MIN_MATCH:
+            flush()
+            commands.extend(struct.pack('<BIH', OP_COPY, offset, length))
+            pos += length
+        else:
+            pending.append(target[pos])
+            pos += 1
+    flush()
+    return bytes(commands)
+
+
+def make_delta(running, new_ota, base_version):
+    """Return the delta OTA image building new_ota from running."""
+    if len(new_ota) < OTA_HEADER_MIN_SIZE:
+        raise ValueError('new OTA file is too short')
+    file_id, _, header_length = struct.unpack_from('<IHH', new_ota, 0)
+    if file_id != OTA_FILE_ID or header_length < OTA_HEADER_MIN_SIZE or header_length > len(new_ota):
+        raise ValueError('new OTA file has no valid OTA header')
+
+    patch = struct.pack('<II', base_version, len(new_ota)) + make_patch(running, new_ota)
+    tag = struct.pack('<HI', TAG_DELTA_PATCH, len(patch)) + patch
+
+    header = bytearray(new_ota[:header_length])
+    struct.pack_into('<H', header, OTA_HEADER_IMAGE_TYPE_OFFSET, IMAGE_TYPE_DELTA)
+    struct.pack_into('<I', header, OTA_HEADER_TOTAL_SIZE_OFFSET, header_length + len(tag))
+    return bytes(header) + tag
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a delta OTA image for the light switch.')
+    parser.add_argument('--base-version', required=True, type=lambda value: int(value, 0),
+                        help='file version of the running image the delta applies to')
+    parser.add_argument('running', help='application image the switches run (.bin)')
+    parser.add_argument('new_ota', help='full OTA file of the new version')
+    parser.add_argument('delta_ota', help='delta OTA file to write')
+    args = parser.parse_args()
+
+    with open(args.running, 'rb') as f:
+        running = f.read()
+    with open(args.new_ota, 'rb') as f:
+        new_ota = f.read()
+
+    delta = make_delta(running, new_ota, args.base_version)
+    with open(args.delta_ota, 'wb') as f:
+        f.write(delta)
+
+    print('%s: %d bytes, %.1f%% of the full OTA file' % (args.delta_ota, len(delta), 100.0 * len(delta) / len(new_ota)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -62,8 +62,75 @@ PURPOSE: Dimmer Switch device definition
 
 #define ZB_HA_HUE_ZLL_DEVICE_VER_DIMMER_SWITCH 0  /*!< Dimmer Switch device version */
 
+/** @brief Device description of the Dimmer Switch endpoints.
+
+    Each endpoint is described once, as a list of X( cluster_id, role, desc, attr_type, name,
+    report_attr_count ) entries:
+    - cluster_id - ZCL cluster ID
+    - role - SERVER or CLIENT
+    - desc - ZB_ZCL_CLUSTER_DESC, or ZB_ZCL_CLUSTER_DESC2 for clusters without role init functions
+    - attr_type - attribute storage type, instantiated as <name>_attr by ZB_HA_HUE_ATTR_STORAGE
+    - name - prefix of the attribute storage and of the attribute list, <name>_attr_list, which
+      the application declares
+    - report_attr_count - number of reportable attributes of the cluster
+
+    The cluster list, the simple descriptor cluster IDs, the reporting context size and the
+    attribute storage are all generated from it. Entries may be listed in any order - the
+    simple descriptor is built with the server clusters first.
+ */
+#define ZB_HA_HUE_ZLL_DIMMER_SWITCH_CLUSTERS( X )                                                               \
+  X( ZB_ZCL_CLUSTER_ID_BASIC,         SERVER, ZB_ZCL_CLUSTER_DESC, zb_zcl_basic_attrs_ext_hue_t, zll_basic_serv,    0 ) \
+  X( ZB_ZCL_CLUSTER_ID_BASIC,         CLIENT, ZB_ZCL_CLUSTER_DESC, zb_zcl_basic_attrs_ext_hue_t, zll_basic_client,  0 ) \
+  X( ZB_ZCL_CLUSTER_ID_IDENTIFY,      CLIENT, ZB_ZCL_CLUSTER_DESC, zb_zcl_identify_attrs_t,      zll_identify,      0 ) \
+  X( ZB_ZCL_CLUSTER_ID_GROUPS,        CLIENT, ZB_ZCL_CLUSTER_DESC, zb_zcl_groups_attrs_t,        zll_groups,        0 ) \
+  X( ZB_ZCL_CLUSTER_ID_ON_OFF,        CLIENT, ZB_ZCL_CLUSTER_DESC, zb_zcl_on_off_attrs_ext_t,    zll_on_off,        0 ) \
+  X( ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL, CLIENT, ZB_ZCL_CLUSTER_DESC, zb_zcl_level_control_attrs_t, zll_level_control, 0 ) \
+  X( ZB_ZCL_CLUSTER_ID_SCENES,        CLIENT, ZB_ZCL_CLUSTER_DESC, zb_zcl_scenes_attrs_t,        zll_scenes,        0 )
+
+#define ZB_HA_HUE_ZHA_DIMMER_SWITCH_CLUSTERS( X )                                                                                  \
+  X( ZB_ZCL_CLUSTER_ID_BASIC,        SERVER, ZB_ZCL_CLUSTER_DESC,  zb_zcl_basic_attrs_ext_hue_t,    zha_basic_serv,        0 )        \
+  X( ZB_ZCL_CLUSTER_ID_POWER_CONFIG, SERVER, ZB_ZCL_CLUSTER_DESC,  zb_zcl_power_config_attrs_ext_t, zha_pwrconf_serv,                \
+     ZB_ZCL_POWER_CONFIG_BAT_PACK_2_REPORT_ATTR_COUNT )                                                                             \
+  X( ZB_ZCL_CLUSTER_ID_IDENTIFY,     SERVER, ZB_ZCL_CLUSTER_DESC,  zb_zcl_identify_attrs_t,         zha_identify_serv,     0 )        \
+  X( ZB_ZCL_CLUSTER_ID_BINARY_INPUT, SERVER, ZB_ZCL_CLUSTER_DESC,  zb_zcl_binary_input_attrs_t,     zha_binary_input_serv,          \
+     ZB_ZCL_BINARY_INPUT_REPORT_ATTR_COUNT )                                                                                        \
+  X( ZB_ZCL_CLUSTER_ID_TUNNEL,       SERVER, ZB_ZCL_CLUSTER_DESC2, zb_zcl_tunneling_attrs_t,        zha_tunnel_serv,       0 )        \
+  X( ZB_ZCL_CLUSTER_ID_OTA_UPGRADE,  CLIENT, ZB_ZCL_CLUSTER_DESC,  ota_client_ota_upgrade_attr_t,   zha_otau,              0 )
+
 /** @cond internals_doc */
 
+/* Generators used with the device descriptions above. */
+#define ZB_HA_HUE_IS_SERVER_SERVER 1
+#define ZB_HA_HUE_IS_SERVER_CLIENT 0
+#define ZB_HA_HUE_IN_CLUSTER_ID_SERVER( cluster_id ) cluster_id,
+#define ZB_HA_HUE_IN_CLUSTER_ID_CLIENT( cluster_id )
+#define ZB_HA_HUE_OUT_CLUSTER_ID_SERVER( cluster_id )
+#define ZB_HA_HUE_OUT_CLUSTER_ID_CLIENT( cluster_id ) cluster_id,
+
+#define ZB_HA_HUE_COUNT_IN( cluster_id, role, desc, attr_type, name, report_attr_count )  \
+  + ZB_HA_HUE_IS_SERVER_##role
+#define ZB_HA_HUE_COUNT_OUT( cluster_id, role, desc, attr_type, name, report_attr_count ) \
+  + ( 1 - ZB_HA_HUE_IS_SERVER_##role )
+#define ZB_HA_HUE_COUNT_REPORT_ATTRS( cluster_id, role, desc, attr_type, name, report_attr_count ) \
+  + ( report_attr_count )
+#define ZB_HA_HUE_IN_CLUSTER_ID( cluster_id, role, desc, attr_type, name, report_attr_count ) \
+  ZB_HA_HUE_IN_CLUSTER_ID_##role( cluster_id )
+#define ZB_HA_HUE_OUT_CLUSTER_ID( cluster_id, role, desc, attr_type, name, report_attr_count ) \
+  ZB_HA_HUE_OUT_CLUSTER_ID_##role( cluster_id )
+#define ZB_HA_HUE_CLUSTER_DESC( cluster_id, role, desc, attr_type, name, report_attr_count ) \
+  desc( cluster_id,                                                                         \
+        ZB_ZCL_ARRAY_SIZE(name##_attr_list, zb_zcl_attr_t),                                 \
+        (name##_attr_list),                                                                 \
+        ZB_ZCL_CLUSTER_##role##_ROLE,                                                       \
+        ZB_ZCL_MANUF_CODE_INVALID ),
+
+/** @brief Declare the attribute storage of all clusters of a device description, e.g. as the
+    members of the application's device context. */
+#define ZB_HA_HUE_ATTR_STORAGE( cluster_id, role, desc, attr_type, name, report_attr_count ) \
+  attr_type name##_attr;
+
+/* The cluster counts are pasted into the simple descriptor type name by ZB_DECLARE_SIMPLE_DESC,
+ * so they have to be literals. They are checked against the device descriptions below. */
 #define ZB_HA_HUE_ZLL_DIMMER_SWITCH_IN_CLUSTER_NUM 1  /*!< Dimmer Switch IN (server) clusters number */
 #define ZB_HA_HUE_ZLL_DIMMER_SWITCH_OUT_CLUSTER_NUM 6 /*!< Dimmer Switch OUT (client) clusters number */
 
@@ -72,7 +139,8 @@ PURPOSE: Dimmer Switch device definition
   (ZB_HA_HUE_ZLL_DIMMER_SWITCH_IN_CLUSTER_NUM + ZB_HA_HUE_ZLL_DIMMER_SWITCH_OUT_CLUSTER_NUM)
 
 /*! Number of attribute for reporting on Dimmer Switch device */
-#define ZB_HA_HUE_ZLL_DIMMER_SWITCH_REPORT_ATTR_COUNT         0
+#define ZB_HA_HUE_ZLL_DIMMER_SWITCH_REPORT_ATTR_COUNT \
+  ( 0 ZB_HA_HUE_ZLL_DIMMER_SWITCH_CLUSTERS( ZB_HA_HUE_COUNT_REPORT_ATTRS ) )
 
 
 /* ***** */
@@ -86,88 +154,33 @@ PURPOSE: Dimmer Switch device definition
 
 /*! Number of attribute for reporting on Dimmer Switch device */
 #define ZB_HA_HUE_ZHA_DIMMER_SWITCH_REPORT_ATTR_COUNT \
-    ( ZB_ZCL_BINARY_INPUT_REPORT_ATTR_COUNT + ZB_ZCL_POWER_CONFIG_BAT_PACK_2_REPORT_ATTR_COUNT )
+  ( 0 ZB_HA_HUE_ZHA_DIMMER_SWITCH_CLUSTERS( ZB_HA_HUE_COUNT_REPORT_ATTRS ) )
 
+ZB_ASSERT_COMPILE_DECL( ( 0 ZB_HA_HUE_ZLL_DIMMER_SWITCH_CLUSTERS( ZB_HA_HUE_COUNT_IN ) ) == ZB_HA_HUE_ZLL_DIMMER_SWITCH_IN_CLUSTER_NUM );
+ZB_ASSERT_COMPILE_DECL( ( 0 ZB_HA_HUE_ZLL_DIMMER_SWITCH_CLUSTERS( ZB_HA_HUE_COUNT_OUT ) ) == ZB_HA_HUE_ZLL_DIMMER_SWITCH_OUT_CLUSTER_NUM );
+ZB_ASSERT_COMPILE_DECL( ( 0 ZB_HA_HUE_ZHA_DIMMER_SWITCH_CLUSTERS( ZB_HA_HUE_COUNT_IN ) ) == ZB_HA_HUE_ZHA_DIMMER_SWITCH_IN_CLUSTER_NUM );
+ZB_ASSERT_COMPILE_DECL( ( 0 ZB_HA_HUE_ZHA_DIMMER_SWITCH_CLUSTERS( ZB_HA_HUE_COUNT_OUT ) ) == ZB_HA_HUE_ZHA_DIMMER_SWITCH_OUT_CLUSTER_NUM );
 
 /** @endcond */
 
-/** @brief Declare cluster list for Dimmer Switch device
+/** @brief Declare cluster list for a Dimmer Switch endpoint
     @param cluster_list_name - cluster list variable name
-    @param basic_attr_list - attribute list for Basic cluster
-    @param identify_attr_list - attribute list for Identify cluster
- */
-// Hue dimmerswitch ZLL profile (ep 1)
-/*
-basic (server)
-basic
-identify
-groups
-on/off
-level control
-scenes
+    @param clusters - device description of the endpoint, e.g. ZB_HA_HUE_ZLL_DIMMER_SWITCH_CLUSTERS
  */
-#define ZB_HA_HUE_ZLL_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( \
-    cluster_list_name,                                    \
-    basic_serv_attr_list,                                 \
-    basic_client_attr_list,                               \
-    identify_attr_list,                                   \
-    groups_attr_list,                                     \
-    on_off_attr_list,                                     \
-    level_control_attr_list,                              \
-    scenes_attr_list )                                    \
-zb_zcl_cluster_desc_t cluster_list_name[] =               \
-{                                                         \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_BASIC,                              \
-    ZB_ZCL_ARRAY_SIZE(basic_serv_attr_list, zb_zcl_attr_t),    \
-    (basic_serv_attr_list),                               \
-    ZB_ZCL_CLUSTER_SERVER_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-    ZB_ZCL_CLUSTER_DESC(                                  \
-    ZB_ZCL_CLUSTER_ID_BASIC,                              \
-    ZB_ZCL_ARRAY_SIZE(basic_client_attr_list, zb_zcl_attr_t),    \
-    (basic_client_attr_list),                             \
-    ZB_ZCL_CLUSTER_CLIENT_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_IDENTIFY,                           \
-    ZB_ZCL_ARRAY_SIZE(identify_attr_list, zb_zcl_attr_t), \
-    (identify_attr_list),                                 \
-    ZB_ZCL_CLUSTER_CLIENT_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_GROUPS,                             \
-    ZB_ZCL_ARRAY_SIZE(groups_attr_list, zb_zcl_attr_t),   \
-    (groups_attr_list),                                   \
-    ZB_ZCL_CLUSTER_CLIENT_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-   ZB_ZCL_CLUSTER_DESC(                                   \
-    ZB_ZCL_CLUSTER_ID_ON_OFF,                             \
-    ZB_ZCL_ARRAY_SIZE(on_off_attr_list, zb_zcl_attr_t),   \
-    (on_off_attr_list),                                   \
-    ZB_ZCL_CLUSTER_CLIENT_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,                      \
-    ZB_ZCL_ARRAY_SIZE(level_control_attr_list, zb_zcl_attr_t),    \
-    (level_control_attr_list),                            \
-    ZB_ZCL_CLUSTER_CLIENT_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_SCENES,                             \
-    ZB_ZCL_ARRAY_SIZE(scenes_attr_list, zb_zcl_attr_t),   \
-    (scenes_attr_list),                                   \
-    ZB_ZCL_CLUSTER_CLIENT_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  )                                                       \
+#define ZB_HA_HUE_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( cluster_list_name, clusters ) \
+zb_zcl_cluster_desc_t cluster_list_name[] =                                         \
+{                                                                                   \
+  clusters( ZB_HA_HUE_CLUSTER_DESC )                                                \
 }
 
+/* Hue dimmerswitch ZLL profile (ep 1) */
+#define ZB_HA_HUE_ZLL_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( cluster_list_name ) \
+  ZB_HA_HUE_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( cluster_list_name, ZB_HA_HUE_ZLL_DIMMER_SWITCH_CLUSTERS )
+
+/* Hue dimmerswitch ZHA profile (ep 2) */
+#define ZB_HA_HUE_ZHA_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( cluster_list_name ) \
+  ZB_HA_HUE_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( cluster_list_name, ZB_HA_HUE_ZHA_DIMMER_SWITCH_CLUSTERS )
+
 
 #define ZB_ZCL_CLUSTER_DESC2(cluster_id, attr_count, attr_desc_list, cluster_role_mask, manuf_code)         \
 {                                                                                                          \
@@ -179,123 +192,56 @@ zb_zcl_cluster_desc_t cluster_list_name[] =               \
   NULL                                                                                                     \
 }
 
-// Hue dimmerswitch ZHA profile (ep 2)
-/*
-basic (server)
-Power config (server)
-identify (server)
-Binary input (server)
-FC00 (server)
-OTAU 
- */
-#define ZB_HA_HUE_ZHA_DECLARE_DIMMER_SWITCH_CLUSTER_LIST( \
-    cluster_list_name,                                    \
-    basic_attr_list,                                      \
-    power_config_attr_list,                               \
-    identify_attr_list,                                   \
-    binary_input_attr_list,                               \
-    fc00_attr_list,                                       \
-    otau_attr_list )                                      \
-zb_zcl_cluster_desc_t cluster_list_name[] =               \
-{                                                         \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_BASIC,                              \
-    ZB_ZCL_ARRAY_SIZE(basic_attr_list, zb_zcl_attr_t),    \
-    (basic_attr_list),                                    \
-    ZB_ZCL_CLUSTER_SERVER_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-    ZB_ZCL_CLUSTER_DESC(                                  \
-    ZB_ZCL_CLUSTER_ID_POWER_CONFIG,                       \
-    ZB_ZCL_ARRAY_SIZE(power_config_attr_list, zb_zcl_attr_t),\
-    power_config_attr_list,                               \
-    ZB_ZCL_CLUSTER_SERVER_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_IDENTIFY,                           \
-    ZB_ZCL_ARRAY_SIZE(identify_attr_list, zb_zcl_attr_t), \
-    identify_attr_list,                                   \
-    ZB_ZCL_CLUSTER_SERVER_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_BINARY_INPUT,                       \
-    ZB_ZCL_ARRAY_SIZE(binary_input_attr_list, zb_zcl_attr_t),\
-    binary_input_attr_list,                               \
-    ZB_ZCL_CLUSTER_SERVER_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-   ZB_ZCL_CLUSTER_DESC2(                                  \
-    ZB_ZCL_CLUSTER_ID_TUNNEL,                             \
-    ZB_ZCL_ARRAY_SIZE(fc00_attr_list, zb_zcl_attr_t),     \
-    fc00_attr_list,                                       \
-    ZB_ZCL_CLUSTER_SERVER_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  ),                                                      \
-  ZB_ZCL_CLUSTER_DESC(                                    \
-    ZB_ZCL_CLUSTER_ID_OTA_UPGRADE,                        \
-    ZB_ZCL_ARRAY_SIZE(otau_attr_list, zb_zcl_attr_t),     \
-    otau_attr_list,                                       \
-    ZB_ZCL_CLUSTER_CLIENT_ROLE,                           \
-    ZB_ZCL_MANUF_CODE_INVALID                             \
-  )                                                       \
-}
-
 
 /** @cond internals_doc */
-/** @brief Declare simple descriptor for Dimmer switch device
+/** @brief Declare simple descriptor for a Dimmer switch endpoint
     @param ep_name - endpoint variable name
     @param ep_id - endpoint ID
     @param in_clust_num - number of supported input clusters
     @param out_clust_num - number of supported output clusters
+    @param profile_id - application profile of the endpoint
+    @param device_id - application device of the endpoint
+    @param clusters - device description of the endpoint
 */
-#define ZB_ZLL_NON_COLOR_SCENE_CONTROLLER_DEVICE_ID 0x0830
-#define ZB_ZCL_HUE_ZLL_DECLARE_DIMMER_SWITCH_SIMPLE_DESC(                     \
-  ep_name, ep_id, in_clust_num, out_clust_num)                                \
+#define ZB_ZCL_HUE_DECLARE_DIMMER_SWITCH_SIMPLE_DESC(                         \
+  ep_name, ep_id, in_clust_num, out_clust_num, profile_id, device_id, clusters) \
   ZB_DECLARE_SIMPLE_DESC(in_clust_num, out_clust_num);                        \
   ZB_AF_SIMPLE_DESC_TYPE(in_clust_num, out_clust_num) simple_desc_##ep_name = \
   {                                                                           \
     ep_id,                                                                    \
-    ZB_AF_ZLL_PROFILE_ID,                                                     \
-    ZB_ZLL_NON_COLOR_SCENE_CONTROLLER_DEVICE_ID,                              \
+    profile_id,                                                               \
+    device_id,                                                                \
     ZB_HA_HUE_ZLL_DEVICE_VER_DIMMER_SWITCH,                                   \
     0,                                                                        \
     in_clust_num,                                                             \
     out_clust_num,                                                            \
     {                                                                         \
-      ZB_ZCL_CLUSTER_ID_BASIC,                                                \
-      ZB_ZCL_CLUSTER_ID_BASIC,                                                \
-      ZB_ZCL_CLUSTER_ID_IDENTIFY,                                             \
-      ZB_ZCL_CLUSTER_ID_GROUPS,                                               \
-      ZB_ZCL_CLUSTER_ID_ON_OFF,                                               \
-      ZB_ZCL_CLUSTER_ID_LEVEL_CONTROL,                                        \
-      ZB_ZCL_CLUSTER_ID_SCENES,                                               \
+      clusters( ZB_HA_HUE_IN_CLUSTER_ID )                                     \
+      clusters( ZB_HA_HUE_OUT_CLUSTER_ID )                                    \
     }                                                                         \
   }
 
+#define ZB_ZLL_NON_COLOR_SCENE_CONTROLLER_DEVICE_ID 0x0830
+/* Device id of the ZLL endpoint, may be overridden by the emulated device model. */
+#ifndef ZB_HA_HUE_ZLL_DEVICE_ID
+#define ZB_HA_HUE_ZLL_DEVICE_ID ZB_ZLL_NON_COLOR_SCENE_CONTROLLER_DEVICE_ID
+#endif
+#define ZB_ZCL_HUE_ZLL_DECLARE_DIMMER_SWITCH_SIMPLE_DESC(                     \
+  ep_name, ep_id, in_clust_num, out_clust_num)                                \
+  ZB_ZCL_HUE_DECLARE_DIMMER_SWITCH_SIMPLE_DESC(ep_name, ep_id,                \
+      in_clust_num, out_clust_num,                                            \
+      ZB_AF_ZLL_PROFILE_ID,                                                   \
+      ZB_HA_HUE_ZLL_DEVICE_ID,                                                \
+      ZB_HA_HUE_ZLL_DIMMER_SWITCH_CLUSTERS)
+
 
 #define ZB_ZCL_HUE_ZHA_DECLARE_DIMMER_SWITCH_SIMPLE_DESC(                     \
   ep_name, ep_id, in_clust_num, out_clust_num)                                \
-  ZB_DECLARE_SIMPLE_DESC(in_clust_num, out_clust_num);                        \
-  ZB_AF_SIMPLE_DESC_TYPE(in_clust_num, out_clust_num) simple_desc_##ep_name = \
-  {                                                                           \
-    ep_id,                                                                    \
-    ZB_AF_HA_PROFILE_ID,                                                      \
-    ZB_HA_SIMPLE_SENSOR_DEVICE_ID,     /* 0x000C */                           \
-    ZB_HA_HUE_ZLL_DEVICE_VER_DIMMER_SWITCH,                                   \
-    0,                                                                        \
-    in_clust_num,                                                             \
-    out_clust_num,                                                            \
-    {                                                                         \
-      ZB_ZCL_CLUSTER_ID_BASIC,                                                \
-      ZB_ZCL_CLUSTER_ID_POWER_CONFIG,                                         \
-      ZB_ZCL_CLUSTER_ID_IDENTIFY,                                             \
-      ZB_ZCL_CLUSTER_ID_BINARY_INPUT,                                         \
-      ZB_ZCL_CLUSTER_ID_TUNNEL,                                               \
-      ZB_ZCL_CLUSTER_ID_OTA_UPGRADE,                                          \
-    }                                                                         \
-  }
+  ZB_ZCL_HUE_DECLARE_DIMMER_SWITCH_SIMPLE_DESC(ep_name, ep_id,                \
+      in_clust_num, out_clust_num,                                            \
+      ZB_AF_HA_PROFILE_ID,                                                    \
+      ZB_HA_SIMPLE_SENSOR_DEVICE_ID,     /* 0x000C */                         \
+      ZB_HA_HUE_ZHA_DIMMER_SWITCH_CLUSTERS)
 
 /** @endcond */
 
@@ -317,14 +263,14 @@ zb_zcl_cluster_desc_t cluster_list_name[] =               \
 #define ZB_HA_HUE_ZHA_DECLARE_DIMMER_SWITCH_EP( ep_name, ep_id, cluster_list )                  \
   ZB_ZCL_HUE_ZHA_DECLARE_DIMMER_SWITCH_SIMPLE_DESC(ep_name, ep_id,                              \
       ZB_HA_HUE_ZHA_DIMMER_SWITCH_IN_CLUSTER_NUM, ZB_HA_HUE_ZHA_DIMMER_SWITCH_OUT_CLUSTER_NUM); \
-  ZBOSS_DEVICE_DECLARE_REPORTING_CTX( reporting_info## device_ctx_name,                         \
+  ZBOSS_DEVICE_DECLARE_REPORTING_CTX( reporting_info##ep_name,                                  \
                                       ZB_HA_HUE_ZHA_DIMMER_SWITCH_REPORT_ATTR_COUNT );          \
                                                                                                 \
   ZB_AF_DECLARE_ENDPOINT_DESC(ep_name, ep_id, ZB_AF_HA_PROFILE_ID, 0, NULL,                     \
                           ZB_ZCL_ARRAY_SIZE(cluster_list, zb_zcl_cluster_desc_t), cluster_list, \
                           (zb_af_simple_desc_1_1_t*)&simple_desc_##ep_name,                     \
                           ZB_HA_HUE_ZHA_DIMMER_SWITCH_REPORT_ATTR_COUNT,                        \
-                          reporting_info## device_ctx_name,                                     \
+                          reporting_info##ep_name,                                              \
                           0, NULL) /* No CVC ctx */
 
 /*!
@@ -336,6 +282,14 @@ zb_zcl_cluster_desc_t cluster_list_name[] =               \
 #define ZB_HA_HUE_DECLARE_DIMMER_SWITCH_CTX(device_ctx, ep_name_zll, ep_name_zha) \
   ZBOSS_DECLARE_DEVICE_CTX_2_EP( device_ctx, ep_name_zll, ep_name_zha )
 
+/*!
+  @brief Declare device context for a build with only one of the two endpoints
+  @param device_ctx - device context variable
+  @param ep_name - endpoint variable name
+*/
+#define ZB_HA_HUE_DECLARE_DIMMER_SWITCH_CTX_1_EP(device_ctx, ep_name) \
+  ZBOSS_DECLARE_DEVICE_CTX_1_EP( device_ctx, ep_name )
+
 /*! @} */
 
 /** @endcond */ /* DOXYGEN_HA_SECTION */
@@ -373,20 +327,37 @@ typedef struct
 } zb_zcl_binary_input_attrs_t;
 
 
-/** @brief Basic cluster attributes according to ZCL Spec 3.2.2.2 */
+/** @brief ZCL character string with a fixed value, encoded with its length byte in front. */
+#define ZB_ZCL_CONST_STRING_DECL( name, value ) \
+    struct { zb_uint8_t len; zb_char_t str[sizeof(value) - 1]; } name
+
+/** @brief Initializer for a ZB_ZCL_CONST_STRING_DECL string. */
+#define ZB_ZCL_CONST_STRING_INIT( value ) { sizeof(value) - 1, value }
+
+/** @brief Basic cluster attributes according to ZCL Spec 3.2.2.2 that never change.
+ *
+ * A single const instance is shared by all endpoints and served from flash. The strings are
+ * sized by the values passed in.
+ */
+#define ZB_ZCL_DECLARE_BASIC_CONST_ATTRS_TYPE( type_name, mf_name_val, model_id_val, date_code_val, sw_ver_val ) \
+typedef struct                                                          \
+{                                                                       \
+    zb_uint8_t zcl_version;                                             \
+    zb_uint8_t app_version;                                             \
+    zb_uint8_t stack_version;                                           \
+    zb_uint8_t hw_version;                                              \
+    zb_uint8_t power_source;                                            \
+    ZB_ZCL_CONST_STRING_DECL( mf_name, mf_name_val );                   \
+    ZB_ZCL_CONST_STRING_DECL( model_id, model_id_val );                 \
+    ZB_ZCL_CONST_STRING_DECL( date_code, date_code_val );               \
+    ZB_ZCL_CONST_STRING_DECL( sw_ver, sw_ver_val );                     \
+} type_name
+
+/** @brief Basic cluster attributes according to ZCL Spec 3.2.2.2 that are kept per endpoint, in RAM. */
 typedef struct
 {
-    zb_uint8_t zcl_version;
-    zb_uint8_t app_version;
-    zb_uint8_t stack_version;
-    zb_uint8_t hw_version;
-    zb_char_t  mf_name[32];
-    zb_char_t  model_id[32];
-    zb_char_t  date_code[16];
-    zb_uint8_t power_source;
     zb_char_t  location_id[15];
     zb_uint8_t ph_env;
-    zb_char_t  sw_ver[17];
     zb_uint8_t philips_device_flag;
     zb_uint16_t philips_en_flag;
 } zb_zcl_basic_attrs_ext_hue_t;